@@ -11,24 +11,36 @@
 namespace chaos
 {
     // ======================================================================================================
-    ApplicationDetails* ApplicationDetails::m_instance = 0;
+    boost::atomic<ApplicationDetails*> ApplicationDetails::m_instance(0);
     namespace app_det
     {
         chaos::SpinLock logLock;
     }
 
     // ======================================================================================================
-    ApplicationDetails* ApplicationDetails::instance()
+    ApplicationDetails* ApplicationDetails::create_instance()
     {
         app_det::logLock.lock();
-        if (m_instance == 0)
+        ApplicationDetails* details = m_instance.load(boost::memory_order_relaxed);
+        if (details == 0)
         {
             // Lets create it
-            m_instance = new ApplicationDetails();
+            details = new ApplicationDetails();
+            m_instance.store(details, boost::memory_order_release);
         }
         app_det::logLock.unlock();
 
-        return m_instance;
+        return details;
+    }
+
+    // ======================================================================================================
+    void ApplicationDetails::shutdown()
+    {
+        app_det::logLock.lock();
+        ApplicationDetails* details = m_instance.exchange(0, boost::memory_order_acq_rel);
+        app_det::logLock.unlock();
+
+        delete details;
     }
 
     // ======================================================================================================
@@ -37,7 +49,6 @@ namespace chaos
         m_application_desc("Generic Chaos App"),
         m_application_inst("UNK"),
         m_application_location("NOT_SET"),
-        m_application_version("v0.0.0"),
         m_application_tcp_port(0),
         m_application_udp_port(0),
         m_mothers_address(""),
@@ -77,6 +88,8 @@ namespace chaos
 
         // Lets grab the current time
         m_application_start_time = chaos::time_as_string_posix();
+
+        publish_snapshot("v0.0.0");
     }
 
     // ======================================================================================================
@@ -92,6 +105,30 @@ namespace chaos
             m_application_tcp_port = tcp;
         if (udp != 0)
             m_application_udp_port = udp;
+
+        publish_snapshot(m_snapshot.load().m_version);
+    }
+
+    // ======================================================================================================
+    void ApplicationDetails::set_version(const std::string& ver)
+    {
+        m_snapshot.update([&ver](ApplicationSnapshot& snapshot) { snapshot.m_version = ver; });
+    }
+
+    // ======================================================================================================
+    void ApplicationDetails::publish_snapshot(const chaos::FixedString<SIZE_40>& version)
+    {
+        // Anything too long for its wire field is truncated here, once, not on every heartbeat
+        ApplicationSnapshot snapshot;
+        snapshot.m_application = m_application_name;
+        snapshot.m_description = m_application_desc;
+        snapshot.m_location = m_application_location;
+        snapshot.m_instance = m_application_inst;
+        snapshot.m_start_time = m_application_start_time;
+        snapshot.m_version = version;
+        snapshot.m_tcp_port = m_application_tcp_port;
+        snapshot.m_udp_port = m_application_udp_port;
+        m_snapshot.store(snapshot);
     }
 
     // ======================================================================================================
@@ -5,12 +5,32 @@
 #pragma once
 
 #include "utils.h"
+#include "seq_lock.h"
+#include "fixed_string.h"
+#include "udp_messages.h"
 
 #include <string>
 
+#include <boost/atomic.hpp>
+
 // ===================================================================================================
 namespace chaos
 {
+    // ===============================================================================================
+    // Fixed size copy of the details that change at run time or get published, the sizes match
+    // the MSG_MOTHER fields so each one goes into the heartbeat with FixedString::copy_to()
+    struct ApplicationSnapshot
+    {
+        chaos::FixedString<SIZE_80>     m_application;
+        chaos::FixedString<SIZE_200>    m_description;
+        chaos::FixedString<SIZE_40>     m_location;
+        chaos::FixedString<SIZE_80>     m_instance;
+        chaos::FixedString<SIZE_40>     m_start_time;
+        chaos::FixedString<SIZE_40>     m_version;
+        std::int32_t    m_tcp_port;
+        std::int32_t    m_udp_port;
+    };
+
     // ===============================================================================================
     class ApplicationDetails
     {
@@ -19,17 +39,29 @@ namespace chaos
 
     public:
         ~ApplicationDetails() {}
-        static ApplicationDetails* instance();
 
+        // Lock free after the first call, see Logger for the start-up and shut-down order
+        static ApplicationDetails* instance()
+        {
+            ApplicationDetails* details = m_instance.load(boost::memory_order_acquire);
+            return (details != 0) ? details : create_instance();
+        }
+
+        static void shutdown();
+
+        // set_details() is meant for start-up, set_version() can be called at any time from any thread
         void set_details(const std::string& app_name, const std::string& app_desc, const std::string& app_inst, std::int32_t tcp, std::int32_t udp);
-        void set_version(const std::string& ver) { m_application_version = ver;  }
+        void set_version(const std::string& ver);
         bool is_configuration_okay();
 
+        // Consistent copy of the published details without locking or allocating
+        void get_snapshot(ApplicationSnapshot& snapshot) const { m_snapshot.load(snapshot); }
+
         const std::string& get_application_name() { return m_application_name; }
         const std::string& get_application_description() { return m_application_desc; }
         const std::string& get_application_instance() { return m_application_inst; }
         const std::string& get_application_location() { return m_application_location; }
-        const std::string& get_application_version() { return m_application_version; }
+        std::string get_application_version() { return m_snapshot.load().m_version.to_string(); }
         const std::string& get_application_start_time() { return m_application_start_time; }
         const std::string& get_mothers_address() { return m_mothers_address; }
         std::int32_t get_mothers_port() { return m_mothers_port; }
@@ -37,18 +69,23 @@ namespace chaos
         std::int32_t get_application_udp_port() { return m_application_udp_port; }
 
     private:
-        static ApplicationDetails*  m_instance;
+        static ApplicationDetails* create_instance();
+        void publish_snapshot(const chaos::FixedString<SIZE_40>& version);
+
+    private:
+        static boost::atomic<ApplicationDetails*>   m_instance;
 
         std::string     m_application_name;
         std::string     m_application_desc;
         std::string     m_application_inst;
         std::string     m_application_location;
-        std::string     m_application_version;
         std::string     m_application_start_time;
         std::int32_t    m_application_tcp_port;
         std::int32_t    m_application_udp_port;
         std::string     m_mothers_address;
         std::int32_t    m_mothers_port;
 
+        chaos::SeqLock<ApplicationSnapshot>     m_snapshot;
+
     };
 } // End of namespace
\ No newline at end of file
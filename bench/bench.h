@@ -0,0 +1,115 @@
+// Microbenchmark harness for the base library
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include "time_utils.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+
+// ===================================================================================================
+namespace chaos
+{
+    namespace bench
+    {
+        // ===========================================================================================
+        // What a benchmark body is handed, it has to do m_iterations operations and nothing else
+        // that it wants to be timed. A multi threaded case runs the same body on every thread at
+        // the same time, m_thread tells them apart. Anything worth reporting besides the time,
+        // the RSS after an allocation run for example, goes in m_counters on thread 0.
+        struct State
+        {
+            std::uint64_t                   m_iterations;
+            std::uint32_t                   m_thread;
+            std::uint32_t                   m_threads;
+            std::map<std::string, double>   m_counters;
+        };
+
+        typedef boost::function<void(State&)> Body;
+
+        // ===========================================================================================
+        struct Benchmark
+        {
+            std::string                 m_group;
+            std::string                 m_name;
+            Body                        m_body;
+            std::vector<std::uint32_t>  m_threads;
+        };
+
+        // ===========================================================================================
+        // One line of output. The times are per operation as seen by one thread, the throughput is
+        // every thread together, from the first thread starting to the last one finishing.
+        struct Result
+        {
+            std::string                     m_group;
+            std::string                     m_name;
+            std::uint32_t                   m_threads;
+            std::uint64_t                   m_iterations;
+            std::uint32_t                   m_samples;
+            double                          m_ns_min;
+            double                          m_ns_median;
+            double                          m_ns_mean;
+            double                          m_ns_max;
+            double                          m_ops_per_sec;
+            std::map<std::string, double>   m_counters;
+        };
+
+        // ===========================================================================================
+        static const std::uint32_t SINGLE_THREAD[] = { 1 };
+        static const std::uint32_t MULTI_THREAD[] = { 1, 2, 4, 8 };
+
+        class Registry
+        {
+        public:
+            template<std::size_t N>
+            void add(const std::string& group, const std::string& name, const Body& body, const std::uint32_t (&threads)[N])
+            {
+                Benchmark b;
+                b.m_group = group;
+                b.m_name = name;
+                b.m_body = body;
+                b.m_threads.assign(threads, threads + N);
+                m_benchmarks.push_back(b);
+            }
+
+            void add(const std::string& group, const std::string& name, const Body& body)
+            {
+                add(group, name, body, SINGLE_THREAD);
+            }
+
+            const std::vector<Benchmark>& get_benchmarks() { return m_benchmarks; }
+
+        private:
+            std::vector<Benchmark>  m_benchmarks;
+
+        };
+
+        // ===========================================================================================
+        // Keeps the compiler from throwing away a result or a store that nothing reads
+        template<class T>
+        static inline void do_not_optimize(const T& value)
+        {
+            asm volatile("" : : "r,m"(value) : "memory");
+        }
+
+        static inline void clobber_memory()
+        {
+            asm volatile("" : : : "memory");
+        }
+
+        // The resident set of the process in KB, from /proc/self/statm
+        std::uint64_t get_rss_kb();
+
+        // Every bench_*.cpp adds its cases here, main() calls them in this order
+        void register_core(Registry& registry);
+        void register_messaging(Registry& registry);
+        void register_types(Registry& registry);
+        void register_math(Registry& registry);
+    }
+} // End of namespace
@@ -0,0 +1,355 @@
+// Locks, queues, the slab allocator and the thread pool
+//
+// Copyright HOLM, 2023
+
+#include "pch.h"
+#include "bench.h"
+#include "spin_lock.h"
+#include "seq_lock.h"
+#include "object_pool.h"
+#include "wait_free_queue.h"
+#include "thread_pool.h"
+
+#include <boost/asio.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/once.hpp>
+#include <boost/thread/thread.hpp>
+
+// ===================================================================================================
+namespace chaos
+{
+    namespace bench
+    {
+        // ===========================================================================================
+        // Every thread takes the same lock to bump the same counter, one thread is the uncontended cost
+        template<class Lock>
+        struct LockCase
+        {
+            Lock                    m_lock;
+            volatile std::uint64_t  m_counter;
+
+            LockCase() : m_counter(0) {}
+
+            void operator()(State& state)
+            {
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    m_lock.lock();
+                    m_counter = m_counter + 1;
+                    m_lock.unlock();
+                }
+            }
+        };
+
+        template<>
+        void LockCase<chaos::McsLock>::operator()(State& state)
+        {
+            for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+            {
+                chaos::McsLock::Guard guard(m_lock);
+                m_counter = m_counter + 1;
+            }
+        }
+
+        template<class Lock>
+        static Body lock_case()
+        {
+            boost::shared_ptr< LockCase<Lock> > c = boost::make_shared< LockCase<Lock> >();
+            return [c](State& state) { (*c)(state); };
+        }
+
+        // ===========================================================================================
+        static void drain_queue(chaos::WaitFreeQueue<std::uint64_t>& queue)
+        {
+            chaos::WaitFreeQueue<std::uint64_t>::node* n = queue.pop_all_reverse();
+            while (n)
+            {
+                chaos::WaitFreeQueue<std::uint64_t>::node* next = n->next;
+                delete n;
+                n = next;
+            }
+        }
+
+        // ===========================================================================================
+        struct alignas(8) PooledObject : public chaos::Pooled<PooledObject>
+        {
+            char    m_data[64];
+        };
+
+        struct alignas(8) PlainObject
+        {
+            char    m_data[64];
+        };
+
+        // Allocate a block of objects and free them again, the way a burst of messages comes and goes
+        template<class Object>
+        static void allocate_case(State& state)
+        {
+            const std::size_t BLOCK = 256;
+            Object* objects[BLOCK];
+            std::uint64_t i = 0;
+            while (i < state.m_iterations)
+            {
+                std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(BLOCK, state.m_iterations - i));
+                for (std::size_t j = 0; j < n; ++j)
+                {
+                    objects[j] = new Object;
+                    objects[j]->m_data[0] = static_cast<char>(j);
+                }
+                do_not_optimize(objects);
+                for (std::size_t j = 0; j < n; ++j)
+                    delete objects[j];
+                i += n;
+            }
+            if (state.m_thread == 0)
+                state.m_counters["rss_kb"] = static_cast<double>(get_rss_kb());
+        }
+
+        // ===========================================================================================
+        // Every thread allocates and one consumer thread frees, the way messages go from the
+        // network threads to a strategy, so the pooled objects all go back to their owners through
+        // the remote lists. The queue nodes are pooled in both cases so only the objects differ.
+        // The case lives for the whole run and the RSS growth since its first sample is what the
+        // allocator held on to, against the same figure for malloc.
+        template<class Object>
+        struct HandOffCase
+        {
+            chaos::WaitFreeQueue<Object*>   m_queue;
+            boost::once_flag                m_started;
+            boost::thread*                  m_consumer;
+            boost::atomic<bool>             m_stop;
+            boost::atomic<std::uint64_t>    m_pushed;
+            boost::atomic<std::uint64_t>    m_done;
+            std::uint64_t                   m_rss_start;
+
+            HandOffCase() : m_started(BOOST_ONCE_INIT), m_consumer(NULL), m_stop(false), m_pushed(0), m_done(0), m_rss_start(0) {}
+
+            ~HandOffCase()
+            {
+                if (m_consumer)
+                {
+                    m_stop.store(true);
+                    m_consumer->join();
+                    delete m_consumer;
+                }
+            }
+
+            void start()
+            {
+                m_rss_start = get_rss_kb();
+                m_consumer = new boost::thread(boost::bind(&HandOffCase::consume, this));
+            }
+
+            // Sleeps once it has been idle for a while, it outlives the case's own samples and
+            // mustn't take a core away from the ones that run after it
+            void consume()
+            {
+                std::uint32_t idle = 0;
+                while (!m_stop.load(boost::memory_order_relaxed))
+                {
+                    typename chaos::WaitFreeQueue<Object*>::node* n = m_queue.pop_all_reverse();
+                    if (!n)
+                    {
+                        if (++idle < 1000)
+                            chaos::cpu_relax();
+                        else
+                            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+                        continue;
+                    }
+                    idle = 0;
+
+                    std::uint64_t count = 0;
+                    while (n)
+                    {
+                        typename chaos::WaitFreeQueue<Object*>::node* next = n->next;
+                        delete n->data;
+                        delete n;
+                        n = next;
+                        ++count;
+                    }
+                    m_done.fetch_add(count, boost::memory_order_release);
+                }
+            }
+
+            void operator()(State& state)
+            {
+                const std::uint64_t BLOCK = 256;
+                const std::uint64_t MAX_IN_FLIGHT = 65536;
+
+                boost::call_once(m_started, boost::bind(&HandOffCase::start, this));
+
+                std::uint64_t i = 0;
+                while (i < state.m_iterations)
+                {
+                    // Counted before they are pushed so the consumer is never ahead of the count
+                    std::uint64_t n = std::min<std::uint64_t>(BLOCK, state.m_iterations - i);
+                    m_pushed.fetch_add(n, boost::memory_order_relaxed);
+                    for (std::uint64_t j = 0; j < n; ++j)
+                    {
+                        Object* object = new Object;
+                        object->m_data[0] = static_cast<char>(j);
+                        m_queue.push(object);
+                    }
+                    i += n;
+
+                    // Keeps a slow consumer from turning the case into a test of the backlog
+                    while (m_pushed.load(boost::memory_order_relaxed) - m_done.load(boost::memory_order_acquire) > MAX_IN_FLIGHT)
+                        boost::this_thread::yield();
+                }
+
+                // Done once the consumer has freed all this thread pushed, or as much as that
+                std::uint64_t target = m_pushed.load(boost::memory_order_relaxed);
+                while (m_done.load(boost::memory_order_acquire) < target)
+                    boost::this_thread::yield();
+
+                if (state.m_thread == 0)
+                {
+                    std::uint64_t rss = get_rss_kb();
+                    state.m_counters["rss_kb"] = static_cast<double>(rss);
+                    state.m_counters["rss_growth_kb"] = static_cast<double>(rss) - static_cast<double>(m_rss_start);
+                }
+            }
+        };
+
+        template<class Object>
+        static Body hand_off_case()
+        {
+            boost::shared_ptr< HandOffCase<Object> > c = boost::make_shared< HandOffCase<Object> >();
+            return [c](State& state) { (*c)(state); };
+        }
+
+        // ===========================================================================================
+        struct Quote
+        {
+            double          m_bid;
+            double          m_ask;
+            std::uint64_t   m_time;
+        };
+
+        // ===========================================================================================
+        // A pool and an io_service with the same number of threads running the same empty tasks,
+        // the cost is the submit plus the hand over to a worker
+        struct PoolCase
+        {
+            std::size_t                         m_workers;
+            boost::shared_ptr<chaos::ThreadPool> m_pool;
+            boost::atomic<std::uint64_t>        m_done;
+
+            PoolCase(std::size_t workers) : m_workers(workers), m_done(0) {}
+
+            void task() { m_done.fetch_add(1, boost::memory_order_relaxed); }
+
+            void operator()(State& state)
+            {
+                if (!m_pool)
+                    m_pool.reset(new chaos::ThreadPool(m_workers, std::vector<std::int32_t>(), false, "Bench"));
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                    m_pool->submit(boost::bind(&PoolCase::task, this));
+                m_pool->wait();
+            }
+        };
+
+        struct IoServiceCase
+        {
+            std::size_t                                     m_workers;
+            boost::asio::io_service                         m_io;
+            boost::shared_ptr<boost::asio::io_service::work> m_work;
+            std::vector<boost::thread*>                     m_threads;
+            boost::atomic<std::uint64_t>                    m_done;
+
+            IoServiceCase(std::size_t workers) : m_workers(workers), m_done(0) {}
+
+            ~IoServiceCase()
+            {
+                m_work.reset();
+                m_io.stop();
+                for (std::size_t i = 0; i < m_threads.size(); ++i)
+                {
+                    m_threads[i]->join();
+                    delete m_threads[i];
+                }
+            }
+
+            void task() { m_done.fetch_add(1, boost::memory_order_relaxed); }
+
+            void operator()(State& state)
+            {
+                if (!m_work)
+                {
+                    m_work.reset(new boost::asio::io_service::work(m_io));
+                    for (std::size_t i = 0; i < m_workers; ++i)
+                        m_threads.push_back(new boost::thread(boost::bind(&boost::asio::io_service::run, &m_io)));
+                }
+
+                std::uint64_t target = m_done.load() + state.m_iterations;
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                    m_io.post(boost::bind(&IoServiceCase::task, this));
+                while (m_done.load(boost::memory_order_relaxed) < target)
+                    boost::this_thread::yield();
+            }
+        };
+
+        // ===========================================================================================
+        void register_core(Registry& registry)
+        {
+            registry.add("locks", "SpinLock", lock_case<chaos::SpinLock>(), MULTI_THREAD);
+            registry.add("locks", "TicketLock", lock_case<chaos::TicketLock>(), MULTI_THREAD);
+            registry.add("locks", "McsLock", lock_case<chaos::McsLock>(), MULTI_THREAD);
+            registry.add("locks", "AdaptiveMutex", lock_case<chaos::AdaptiveMutex>(), MULTI_THREAD);
+            registry.add("locks", "boost::mutex", lock_case<boost::mutex>(), MULTI_THREAD);
+
+            boost::shared_ptr< chaos::SeqLock<Quote> > quote = boost::make_shared< chaos::SeqLock<Quote> >();
+            registry.add("locks", "SeqLock::store", [quote](State& state)
+            {
+                Quote q = { 1.0, 2.0, 0 };
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    q.m_time = i;
+                    quote->store(q);
+                }
+            });
+            registry.add("locks", "SeqLock::load", [quote](State& state)
+            {
+                Quote q;
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    quote->load(q);
+                    do_not_optimize(q);
+                }
+            }, MULTI_THREAD);
+
+            boost::shared_ptr< chaos::WaitFreeQueue<std::uint64_t> > queue = boost::make_shared< chaos::WaitFreeQueue<std::uint64_t> >();
+            registry.add("queue", "WaitFreeQueue::push", [queue](State& state)
+            {
+                // Every thread empties the queue now and again so it never grows past a few thousand
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    queue->push(i);
+                    if ((i & 1023) == 1023)
+                        drain_queue(*queue);
+                }
+                drain_queue(*queue);
+            }, MULTI_THREAD);
+
+            registry.add("alloc", "Pooled new/delete 64B", allocate_case<PooledObject>, MULTI_THREAD);
+            registry.add("alloc", "malloc new/delete 64B", allocate_case<PlainObject>, MULTI_THREAD);
+            registry.add("alloc", "Pooled new, delete on another thread 64B", hand_off_case<PooledObject>(), MULTI_THREAD);
+            registry.add("alloc", "malloc new, delete on another thread 64B", hand_off_case<PlainObject>(), MULTI_THREAD);
+
+            const std::size_t workers[] = { 1, 2, 4 };
+            for (std::size_t i = 0; i < sizeof(workers) / sizeof(workers[0]); ++i)
+            {
+                std::string suffix = " " + std::to_string(workers[i]) + " workers";
+                boost::shared_ptr<PoolCase> pool = boost::make_shared<PoolCase>(workers[i]);
+                registry.add("tasks", "ThreadPool::submit" + suffix, [pool](State& state) { (*pool)(state); });
+                boost::shared_ptr<IoServiceCase> io = boost::make_shared<IoServiceCase>(workers[i]);
+                registry.add("tasks", "io_service::post" + suffix, [io](State& state) { (*io)(state); });
+            }
+        }
+    }
+} // End of namespace
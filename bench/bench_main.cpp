@@ -0,0 +1,406 @@
+// Microbenchmark harness for the base library
+//
+// Copyright HOLM, 2023
+
+#include "pch.h"
+#include "bench.h"
+#include "logger.h"
+#include "application_details.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <time.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+
+// ===================================================================================================
+namespace chaos
+{
+    namespace bench
+    {
+        // ===========================================================================================
+        struct Options
+        {
+            std::string                 m_filter;
+            std::string                 m_format;
+            std::string                 m_out;
+            std::vector<std::uint32_t>  m_threads;
+            double                      m_min_time;
+            std::uint32_t               m_samples;
+            bool                        m_list;
+            bool                        m_oversubscribe;
+
+            Options() : m_format("table"), m_min_time(0.25), m_samples(5), m_list(false), m_oversubscribe(false) {}
+        };
+
+        // ===========================================================================================
+        static std::uint64_t monotonic_ns()
+        {
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+        }
+
+        // ===========================================================================================
+        // TSC ticks per nanosecond, measured once against CLOCK_MONOTONIC
+        static double ticks_per_ns()
+        {
+            static double rate = 0;
+            if (rate == 0)
+            {
+                std::uint64_t start = monotonic_ns();
+                std::uint64_t start_tsc = chaos::get_point_in_time();
+                while (monotonic_ns() - start < 20000000ULL)
+                    ;
+                std::uint64_t end_tsc = chaos::get_point_in_time();
+                rate = static_cast<double>(end_tsc - start_tsc) / static_cast<double>(monotonic_ns() - start);
+            }
+            return rate;
+        }
+
+        // ===========================================================================================
+        std::uint64_t get_rss_kb()
+        {
+            std::ifstream statm("/proc/self/statm");
+            std::uint64_t size = 0, resident = 0;
+            statm >> size >> resident;
+            return resident * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+
+        // ===========================================================================================
+        struct Run
+        {
+            const Benchmark*                m_benchmark;
+            std::vector<State>              m_states;
+            std::vector<std::uint64_t>      m_start;
+            std::vector<std::uint64_t>      m_end;
+            boost::atomic<std::uint32_t>    m_ready;
+            boost::atomic<bool>             m_go;
+
+            Run(const Benchmark& b, std::uint32_t threads, std::uint64_t iterations) :
+                m_benchmark(&b),
+                m_states(threads),
+                m_start(threads, 0),
+                m_end(threads, 0),
+                m_ready(0),
+                m_go(false)
+            {
+                for (std::uint32_t t = 0; t < threads; ++t)
+                {
+                    m_states[t].m_iterations = iterations;
+                    m_states[t].m_thread = t;
+                    m_states[t].m_threads = threads;
+                }
+            }
+
+            void worker(std::uint32_t t)
+            {
+                // Yield rather than spin while waiting, there may be fewer cores than threads
+                m_ready.fetch_add(1);
+                while (!m_go.load(boost::memory_order_acquire))
+                    boost::this_thread::yield();
+                time(t);
+            }
+
+            void time(std::uint32_t t)
+            {
+                m_start[t] = chaos::get_point_in_time();
+                m_benchmark->m_body(m_states[t]);
+                m_end[t] = chaos::get_point_in_time();
+            }
+
+            // Wall clock ticks from the first thread starting to the last one finishing
+            std::uint64_t execute()
+            {
+                std::uint32_t threads = static_cast<std::uint32_t>(m_states.size());
+                if (threads == 1)
+                    time(0);
+                else
+                {
+                    std::vector<boost::thread*> workers;
+                    for (std::uint32_t t = 1; t < threads; ++t)
+                        workers.push_back(new boost::thread(&Run::worker, this, t));
+                    while (m_ready.load() != threads - 1)
+                        boost::this_thread::yield();
+                    m_go.store(true, boost::memory_order_release);
+                    time(0);
+                    for (std::size_t i = 0; i < workers.size(); ++i)
+                    {
+                        workers[i]->join();
+                        delete workers[i];
+                    }
+                }
+
+                std::uint64_t start = *std::min_element(m_start.begin(), m_start.end());
+                std::uint64_t end = *std::max_element(m_end.begin(), m_end.end());
+                return (end > start) ? end - start : 1;
+            }
+        };
+
+        // ===========================================================================================
+        static Result run_benchmark(const Benchmark& b, std::uint32_t threads, const Options& options)
+        {
+            // Grow the iteration count until one sample takes its share of the minimum time, the
+            // runs on the way up double as the warm up
+            const double target_ns = options.m_min_time * 1e9 / options.m_samples;
+            std::uint64_t iterations = 1;
+            for (;;)
+            {
+                Run run(b, threads, iterations);
+                double ns = run.execute() / ticks_per_ns();
+                if (ns >= target_ns || iterations >= (1ULL << 40))
+                    break;
+
+                double scale = (ns > 0) ? (target_ns * 1.2) / ns : 10.0;
+                scale = std::max(2.0, std::min(10.0, scale));
+                iterations = static_cast<std::uint64_t>(iterations * scale);
+            }
+
+            Result result;
+            result.m_group = b.m_group;
+            result.m_name = b.m_name;
+            result.m_threads = threads;
+            result.m_iterations = iterations;
+            result.m_samples = options.m_samples;
+
+            std::vector<double> per_op;
+            double total_ns = 0;
+            for (std::uint32_t s = 0; s < options.m_samples; ++s)
+            {
+                Run run(b, threads, iterations);
+                double ns = run.execute() / ticks_per_ns();
+                per_op.push_back(ns / iterations);
+                total_ns += ns;
+                result.m_counters = run.m_states[0].m_counters;
+            }
+
+            std::sort(per_op.begin(), per_op.end());
+            result.m_ns_min = per_op.front();
+            result.m_ns_max = per_op.back();
+            result.m_ns_median = per_op[per_op.size() / 2];
+            result.m_ns_mean = total_ns / options.m_samples / iterations;
+            result.m_ops_per_sec = 1e9 * threads * iterations * options.m_samples / total_ns;
+            return result;
+        }
+
+        // ===========================================================================================
+        static std::string format_counters(const std::map<std::string, double>& counters, const char* separator)
+        {
+            std::stringstream ss;
+            for (std::map<std::string, double>::const_iterator it = counters.begin(); it != counters.end(); ++it)
+                ss << (it == counters.begin() ? "" : separator) << it->first << "=" << it->second;
+            return ss.str();
+        }
+
+        // ===========================================================================================
+        static std::string json_string(const std::string& s)
+        {
+            std::string out = "\"";
+            for (std::size_t i = 0; i < s.size(); ++i)
+            {
+                if (s[i] == '"' || s[i] == '\\')
+                    out += '\\';
+                out += s[i];
+            }
+            return out + "\"";
+        }
+
+        // ===========================================================================================
+        static void write_table_row(std::ostream& os, const Result& r)
+        {
+            std::string name = r.m_group + "/" + r.m_name;
+            os << std::left << std::setw(52) << name << std::right
+               << std::setw(4) << r.m_threads
+               << std::fixed << std::setprecision(2)
+               << std::setw(12) << r.m_ns_median
+               << std::setw(12) << r.m_ns_min
+               << std::setw(12) << r.m_ns_max
+               << std::setprecision(0) << std::setw(16) << r.m_ops_per_sec
+               << "  " << format_counters(r.m_counters, " ") << std::endl;
+        }
+
+        // ===========================================================================================
+        static void write_csv_row(std::ostream& os, const Result& r)
+        {
+            os << r.m_group << "," << r.m_name << "," << r.m_threads << "," << r.m_iterations << "," << r.m_samples
+               << std::fixed << std::setprecision(3)
+               << "," << r.m_ns_min << "," << r.m_ns_median << "," << r.m_ns_mean << "," << r.m_ns_max
+               << std::setprecision(0) << "," << r.m_ops_per_sec
+               << "," << format_counters(r.m_counters, ";") << "\n";
+        }
+
+        // ===========================================================================================
+        static void write_json(std::ostream& os, const std::vector<Result>& results)
+        {
+            os << "{\n  \"context\": { \"cpus\": " << boost::thread::hardware_concurrency()
+               << ", \"tsc_ghz\": " << std::setprecision(4) << ticks_per_ns()
+               << ", \"time\": " << json_string(chaos::time_as_string("%Y-%m-%dT%H:%M:%S")) << " },\n  \"benchmarks\": [\n";
+            for (std::size_t i = 0; i < results.size(); ++i)
+            {
+                const Result& r = results[i];
+                os << "    { \"group\": " << json_string(r.m_group) << ", \"name\": " << json_string(r.m_name)
+                   << ", \"threads\": " << r.m_threads << ", \"iterations\": " << r.m_iterations << ", \"samples\": " << r.m_samples
+                   << std::fixed << std::setprecision(3)
+                   << ", \"ns_min\": " << r.m_ns_min << ", \"ns_median\": " << r.m_ns_median
+                   << ", \"ns_mean\": " << r.m_ns_mean << ", \"ns_max\": " << r.m_ns_max
+                   << std::setprecision(0) << ", \"ops_per_sec\": " << r.m_ops_per_sec
+                   << ", \"counters\": {";
+                for (std::map<std::string, double>::const_iterator it = r.m_counters.begin(); it != r.m_counters.end(); ++it)
+                    os << (it == r.m_counters.begin() ? " " : ", ") << json_string(it->first) << ": " << std::setprecision(3) << it->second;
+                os << (r.m_counters.empty() ? "}" : " }") << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+                os.unsetf(std::ios::floatfield);
+            }
+            os << "  ]\n}\n";
+        }
+
+        // ===========================================================================================
+        static void write_output(FILE* out, const std::string& text)
+        {
+            fputs(text.c_str(), out);
+            fflush(out);
+        }
+
+        // ===========================================================================================
+        static void parse_threads(const std::string& list, std::vector<std::uint32_t>& threads)
+        {
+            std::stringstream ss(list);
+            std::string item;
+            while (std::getline(ss, item, ','))
+            {
+                std::int32_t n = atoi(item.c_str());
+                if (n > 0)
+                    threads.push_back(static_cast<std::uint32_t>(n));
+            }
+        }
+
+        // ===========================================================================================
+        static bool parse_options(int argc, char** argv, Options& options)
+        {
+            for (int i = 1; i < argc; ++i)
+            {
+                std::string arg = argv[i];
+                std::string value = (arg.find('=') != std::string::npos) ? arg.substr(arg.find('=') + 1) : "";
+                if (arg.compare(0, 9, "--filter=") == 0)
+                    options.m_filter = value;
+                else if (arg.compare(0, 9, "--format=") == 0)
+                    options.m_format = value;
+                else if (arg.compare(0, 6, "--out=") == 0)
+                    options.m_out = value;
+                else if (arg.compare(0, 10, "--threads=") == 0)
+                    parse_threads(value, options.m_threads);
+                else if (arg.compare(0, 11, "--min-time=") == 0)
+                    options.m_min_time = std::max(0.001, atof(value.c_str()));
+                else if (arg.compare(0, 10, "--samples=") == 0)
+                    options.m_samples = std::max(1, atoi(value.c_str()));
+                else if (arg == "--list")
+                    options.m_list = true;
+                else if (arg == "--oversubscribe")
+                    options.m_oversubscribe = true;
+                else
+                {
+                    std::cerr << "usage: " << argv[0] << " [--filter=text] [--format=table|csv|json] [--out=file]\n"
+                              << "       [--threads=1,2,4] [--min-time=seconds] [--samples=n] [--oversubscribe] [--list]\n";
+                    return false;
+                }
+            }
+            return (options.m_format == "table" || options.m_format == "csv" || options.m_format == "json");
+        }
+    }
+} // End of namespace
+
+// ===================================================================================================
+int main(int argc, char** argv)
+{
+    using namespace chaos::bench;
+
+    Options options;
+    if (!parse_options(argc, argv, options))
+        return 1;
+
+    // The logging cases need somewhere to write and no per site limit getting in the way, anything
+    // already set in the environment wins
+    setenv("LOG_DIRECTORY", "/tmp", 0);
+    setenv("CHAOS_MOTHERS_ADDRESS", "127.0.0.1", 0);
+    setenv("CHAOS_MOTHERS_PORT", "29999", 0);
+    setenv("CHAOS_LOG_SITE_LIMIT", "1000000000", 0);
+    setenv("CHAOS_NO_CRASH_HANDLER", "1", 0);
+
+    Registry registry;
+    register_core(registry);
+    register_messaging(registry);
+    register_types(registry);
+    register_math(registry);
+
+    const std::vector<Benchmark>& benchmarks = registry.get_benchmarks();
+    if (options.m_list)
+    {
+        for (std::size_t i = 0; i < benchmarks.size(); ++i)
+            std::cout << benchmarks[i].m_group << "/" << benchmarks[i].m_name << std::endl;
+        return 0;
+    }
+
+    // The logger points std::cout at its file once it starts, so the results go out through stdio
+    FILE* out = options.m_out.empty() ? stdout : fopen(options.m_out.c_str(), "w");
+    if (!out)
+    {
+        perror(options.m_out.c_str());
+        return 1;
+    }
+
+    std::stringstream header;
+    if (options.m_format == "table")
+        header << std::left << std::setw(52) << "benchmark" << std::right << std::setw(4) << "thr" << std::setw(12) << "ns/op"
+               << std::setw(12) << "min" << std::setw(12) << "max" << std::setw(16) << "ops/sec" << std::endl;
+    else if (options.m_format == "csv")
+        header << "group,name,threads,iterations,samples,ns_min,ns_median,ns_mean,ns_max,ops_per_sec,counters\n";
+    write_output(out, header.str());
+
+    std::uint32_t cores = std::max(1U, boost::thread::hardware_concurrency());
+    std::vector<Result> results;
+    for (std::size_t i = 0; i < benchmarks.size(); ++i)
+    {
+        const Benchmark& b = benchmarks[i];
+        if (!options.m_filter.empty() && (b.m_group + "/" + b.m_name).find(options.m_filter) == std::string::npos)
+            continue;
+
+        // --threads replaces the thread counts of the multi threaded cases only
+        std::vector<std::uint32_t> threads = (b.m_threads.size() > 1 && !options.m_threads.empty()) ? options.m_threads : b.m_threads;
+        for (std::size_t t = 0; t < threads.size(); ++t)
+        {
+            // More threads than cores turns every spinning wait into a scheduler time slice, the
+            // numbers mean nothing and a run can take hours
+            if (threads[t] > 1 && threads[t] > cores && !options.m_oversubscribe)
+                continue;
+
+            Result r = run_benchmark(b, threads[t], options);
+            results.push_back(r);
+
+            std::stringstream row;
+            if (options.m_format == "table")
+                write_table_row(row, r);
+            else if (options.m_format == "csv")
+                write_csv_row(row, r);
+            write_output(out, row.str());
+        }
+    }
+
+    if (options.m_format == "json")
+    {
+        std::stringstream json;
+        write_json(json, results);
+        write_output(out, json.str());
+    }
+    if (out != stdout)
+        fclose(out);
+
+    chaos::Logger::shutdown();
+    chaos::ApplicationDetails::shutdown();
+    return 0;
+}
@@ -0,0 +1,198 @@
+// Statistics kernels and the rolling windows
+//
+// Copyright HOLM, 2023
+
+#include "pch.h"
+#include "bench.h"
+#include "math_statistics.h"
+#include "math_quantiles.h"
+#include "math_covariance.h"
+#include "math_rolling_batch.h"
+
+#include <random>
+
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+
+// ===================================================================================================
+namespace chaos
+{
+    namespace bench
+    {
+        namespace stats = chaos::math::statistics;
+
+        // ===========================================================================================
+        // A random walk of prices, far enough from zero that the shifted sums matter
+        static const std::size_t PRICES = 4096;
+
+        static boost::shared_ptr< std::vector<double> > price_path()
+        {
+            boost::shared_ptr< std::vector<double> > prices = boost::make_shared< std::vector<double> >();
+            std::mt19937_64 rng(7);
+            std::normal_distribution<double> step(0.0, 0.01);
+            double price = 104.25;
+            for (std::size_t i = 0; i < PRICES; ++i)
+            {
+                price += step(rng);
+                prices->push_back(price);
+            }
+            return prices;
+        }
+
+        // ===========================================================================================
+        // Windows are filled before the first sample so every add is the steady state cost
+        template<class Window>
+        static Body window_case(boost::shared_ptr<Window> window, boost::shared_ptr< std::vector<double> > prices, std::size_t fill)
+        {
+            for (std::size_t i = 0; i < fill; ++i)
+                window->add((*prices)[i & (PRICES - 1)]);
+            return [window, prices](State& state)
+            {
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                    window->add((*prices)[i & (PRICES - 1)]);
+            };
+        }
+
+        // ===========================================================================================
+        void register_math(Registry& registry)
+        {
+            boost::shared_ptr< std::vector<double> > prices = price_path();
+            boost::shared_ptr< std::vector<double> > window = boost::make_shared< std::vector<double> >(prices->begin(), prices->begin() + 500);
+
+            registry.add("statistics", "mean_v1 500", [window](State& state)
+            {
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    clobber_memory();
+                    do_not_optimize(stats::mean_v1(*window));
+                }
+            });
+
+            registry.add("statistics", "mean_v2 500", [window](State& state)
+            {
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    clobber_memory();
+                    do_not_optimize(stats::mean_v2(*window));
+                }
+            });
+
+            registry.add("statistics", "stdev_p 500", [window](State& state)
+            {
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    clobber_memory();
+                    do_not_optimize(stats::stdev_p(*window));
+                }
+            });
+
+            registry.add("statistics", "moments 500", [window](State& state)
+            {
+                double m, std, sk, ku;
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    clobber_memory();
+                    stats::moments(*window, m, std, sk, ku);
+                    do_not_optimize(ku);
+                }
+            });
+
+            // The bounded error modes against the plain loops above
+            const stats::SummationMode modes[] = { stats::SM_Kahan, stats::SM_Pairwise };
+            const char* mode_names[] = { "kahan", "pairwise" };
+            for (std::size_t i = 0; i < 2; ++i)
+            {
+                stats::SummationMode mode = modes[i];
+                registry.add("statistics", std::string("mean ") + mode_names[i] + " 500", [window, mode](State& state)
+                {
+                    for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                    {
+                        clobber_memory();
+                        do_not_optimize(stats::mean(*window, mode));
+                    }
+                });
+
+                registry.add("statistics", std::string("moments ") + mode_names[i] + " 500", [window, mode](State& state)
+                {
+                    double m, std, sk, ku;
+                    for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                    {
+                        clobber_memory();
+                        stats::moments(*window, m, std, sk, ku, mode);
+                        do_not_optimize(ku);
+                    }
+                });
+            }
+
+            // ---------------------------------------------------------------------------------------
+            registry.add("windows", "RollingWindow::add 500",
+                         window_case(boost::make_shared<stats::RollingWindow>(500), prices, 500));
+            registry.add("windows", "RollingWindow::add 500 avg_only",
+                         window_case(boost::make_shared<stats::RollingWindow>(500, true), prices, 500));
+            registry.add("windows", "RollingWindow::add 500 pairwise",
+                         window_case(boost::make_shared<stats::RollingWindow>(500, false, stats::SM_Pairwise), prices, 500));
+            registry.add("windows", "RollingWindow::add 500 kahan",
+                         window_case(boost::make_shared<stats::RollingWindow>(500, false, stats::SM_Kahan), prices, 500));
+            registry.add("windows", "RollingWindow::add 500 lazy",
+                         window_case(boost::make_shared<stats::RollingWindow>(500, false, stats::SM_Fast, true), prices, 500));
+
+            // A fast feed read on a timer, 100 adds for every read
+            boost::shared_ptr<stats::RollingWindow> lazy = boost::make_shared<stats::RollingWindow>(500, false, stats::SM_Fast, true);
+            for (std::size_t i = 0; i < 500; ++i)
+                lazy->add((*prices)[i]);
+            registry.add("windows", "RollingWindow lazy 100 adds + get_values", [lazy, prices](State& state)
+            {
+                double m, std, sk, ku;
+                std::size_t n = 0;
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    for (std::size_t j = 0; j < 100; ++j)
+                        lazy->add((*prices)[n++ & (PRICES - 1)]);
+                    lazy->get_values(m, std, sk, ku);
+                    do_not_optimize(ku);
+                }
+            });
+
+            registry.add("windows", "ExponentialWindow::add",
+                         window_case(boost::make_shared<stats::ExponentialWindow>(500), prices, 500));
+            registry.add("windows", "SlidingMinMax::add 500",
+                         window_case(boost::make_shared<stats::SlidingMinMax>(500), prices, 500));
+            registry.add("windows", "RollingQuantile::add 500",
+                         window_case(boost::make_shared<stats::RollingQuantile>(500, 0.95), prices, 500));
+            registry.add("windows", "P2Quantile::add",
+                         window_case(boost::make_shared<stats::P2Quantile>(0.95), prices, 500));
+
+            boost::shared_ptr<stats::TimeWindow> time_window = boost::make_shared<stats::TimeWindow>(500);
+            boost::shared_ptr<std::uint64_t> now = boost::make_shared<std::uint64_t>(0);
+            registry.add("windows", "TimeWindow::add 500", [time_window, now, prices](State& state)
+            {
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                    time_window->add((*prices)[i & (PRICES - 1)], ++*now);
+            });
+
+            // 64 series in one batch, one tick adds a value to every series
+            boost::shared_ptr<stats::RollingWindowBatch> batch = boost::make_shared<stats::RollingWindowBatch>(64, 500);
+            registry.add("windows", "RollingWindowBatch 64 series (per tick)", [batch, prices](State& state)
+            {
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    for (std::uint32_t s = 0; s < 64; ++s)
+                        batch->add(s, (*prices)[(i + s) & (PRICES - 1)]);
+                    batch->update();
+                }
+            });
+
+            boost::shared_ptr<stats::RollingCovariance> covariance = boost::make_shared<stats::RollingCovariance>(16, 500);
+            registry.add("windows", "RollingCovariance 16 series (per tick)", [covariance, prices](State& state)
+            {
+                double x[16];
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    for (std::size_t s = 0; s < 16; ++s)
+                        x[s] = (*prices)[(i + s * 31) & (PRICES - 1)];
+                    covariance->add(x);
+                }
+            });
+        }
+    }
+} // End of namespace
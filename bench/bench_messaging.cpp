@@ -0,0 +1,166 @@
+// Logging, UDP and the shared memory ring
+//
+// Copyright HOLM, 2023
+
+#include "pch.h"
+#include "bench.h"
+#include "logger.h"
+#include "udp.h"
+#include "shm_ring.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <boost/asio.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+
+// ===================================================================================================
+namespace chaos
+{
+    namespace bench
+    {
+        // ===========================================================================================
+        // A socket on an ephemeral loopback port for the Udp object to send to, the sink is never
+        // read so anything past its buffer is dropped by the kernel without an error
+        struct Receiver
+        {
+            int             m_fd;
+            std::uint16_t   m_port;
+
+            Receiver() : m_fd(-1), m_port(0)
+            {
+                m_fd = socket(AF_INET, SOCK_DGRAM, 0);
+                sockaddr_in addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                socklen_t length = sizeof(addr);
+                if (m_fd >= 0 && bind(m_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+                    getsockname(m_fd, reinterpret_cast<sockaddr*>(&addr), &length) == 0)
+                    m_port = ntohs(addr.sin_port);
+            }
+
+            ~Receiver()
+            {
+                if (m_fd >= 0)
+                    close(m_fd);
+            }
+        };
+
+        // ===========================================================================================
+        struct UdpCase
+        {
+            boost::asio::io_service     m_io;
+            Receiver                    m_receiver;
+            chaos::Udp                  m_udp;
+            chaos::UDP_MSG              m_msg;
+            std::vector<chaos::UDP_MSG> m_batch;
+
+            UdpCase() :
+                m_udp(m_io, "127.0.0.1", m_receiver.m_port, false, false),
+                m_batch(64)
+            {
+                m_msg.clear();
+                m_msg.header.m_type = chaos::MessageTypes::CONTROL;
+                m_msg.header.m_length = m_msg.control.getLength();
+                for (std::size_t i = 0; i < m_batch.size(); ++i)
+                    memcpy(&m_batch[i], &m_msg, sizeof(chaos::UDP_MSG));
+            }
+        };
+
+        // ===========================================================================================
+        struct ShmCase
+        {
+            chaos::ShmPublisher     m_publisher;
+            chaos::ShmSubscriber    m_subscriber;
+            chaos::UDP_MSG          m_msg;
+            chaos::UDP_MSG          m_in;
+
+            ShmCase() :
+                m_publisher("bench", 4096, true),
+                m_subscriber(m_publisher.get_fd())
+            {
+                m_subscriber.attach();
+                m_msg.clear();
+                m_msg.header.m_type = chaos::MessageTypes::CONTROL;
+                m_msg.header.m_length = m_msg.control.getLength();
+            }
+        };
+
+        // ===========================================================================================
+        void register_messaging(Registry& registry)
+        {
+            registry.add("log", "LOG filtered by level", [](State& state)
+            {
+                chaos::Logger::instance();
+                chaos::Logger::set_log_level(ERR_MSG);
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                    LOG(DEB_MSG, "filtered " + std::to_string(i));
+            }, MULTI_THREAD);
+
+            // The flush charges the writer thread to the case that filled the queue, rather than
+            // leaving a backlog for whatever runs next
+            registry.add("log", "LOG enqueue+write", [](State& state)
+            {
+                chaos::Logger::instance();
+                chaos::Logger::set_log_level(DEB_MSG);
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                    LOG(INF_MSG, "benchmark message");
+                if (state.m_thread == 0)
+                    chaos::Logger::instance()->flush();
+            }, MULTI_THREAD);
+
+            registry.add("log", "Logger::log_information enqueue+write", [](State& state)
+            {
+                chaos::Logger* logger = chaos::Logger::instance();
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                    logger->log_information(INF_MSG, "benchmark message", __FILE__, __LINE__);
+                if (state.m_thread == 0)
+                    logger->flush();
+            });
+
+            boost::shared_ptr<UdpCase> udp = boost::make_shared<UdpCase>();
+            registry.add("udp", "Udp::send_msg", [udp](State& state)
+            {
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                    udp->m_udp.send_msg(udp->m_msg);
+            });
+
+            registry.add("udp", "Udp::send_batch x64 (per message)", [udp](State& state)
+            {
+                std::uint64_t i = 0;
+                while (i < state.m_iterations)
+                {
+                    std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(udp->m_batch.size(), state.m_iterations - i));
+                    udp->m_udp.send_batch(&udp->m_batch[0], n);
+                    i += n;
+                }
+            });
+
+            // The same message handed from one side to the other, through the kernel and through memory
+            boost::shared_ptr<UdpCase> loopback = boost::make_shared<UdpCase>();
+            registry.add("transport", "udp loopback send+recv", [loopback](State& state)
+            {
+                char buffer[sizeof(chaos::UDP_MSG)];
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    loopback->m_udp.send_msg(loopback->m_msg);
+                    recv(loopback->m_receiver.m_fd, buffer, sizeof(buffer), 0);
+                }
+            });
+
+            boost::shared_ptr<ShmCase> shm = boost::make_shared<ShmCase>();
+            registry.add("transport", "shm ring send+poll", [shm](State& state)
+            {
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    shm->m_publisher.send_msg(shm->m_msg);
+                    shm->m_subscriber.poll(shm->m_in);
+                }
+            });
+        }
+    }
+} // End of namespace
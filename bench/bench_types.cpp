@@ -0,0 +1,231 @@
+// Ids, fixed size value types and the hash map
+//
+// Copyright HOLM, 2023
+
+#include "pch.h"
+#include "bench.h"
+#include "uuid.h"
+#include "unique_id.h"
+#include "fixed_decimal.h"
+#include "fixed_string.h"
+#include "flat_hash_map.h"
+#include "udp_messages.h"
+
+#include <cstdio>
+#include <map>
+#include <random>
+#include <unordered_map>
+
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+
+// ===================================================================================================
+namespace chaos
+{
+    namespace bench
+    {
+        // ===========================================================================================
+        // The same keys in every map, lookups walk a shuffled list so the access pattern is random
+        template<class Key>
+        struct MapKeys
+        {
+            static const std::size_t    SIZE = 100000;
+            static const std::size_t    LOOKUPS = 65536;
+
+            std::vector<Key>    m_keys;
+            std::vector<Key>    m_hits;
+            std::vector<Key>    m_misses;
+        };
+
+        static boost::shared_ptr< MapKeys<std::uint64_t> > integer_keys()
+        {
+            boost::shared_ptr< MapKeys<std::uint64_t> > keys = boost::make_shared< MapKeys<std::uint64_t> >();
+            std::mt19937_64 rng(42);
+            for (std::size_t i = 0; i < MapKeys<std::uint64_t>::SIZE; ++i)
+                keys->m_keys.push_back(rng());
+            for (std::size_t i = 0; i < MapKeys<std::uint64_t>::LOOKUPS; ++i)
+            {
+                keys->m_hits.push_back(keys->m_keys[rng() % keys->m_keys.size()]);
+                keys->m_misses.push_back(rng() | 1);
+            }
+            return keys;
+        }
+
+        static boost::shared_ptr< MapKeys<std::string> > symbol_keys(std::size_t count)
+        {
+            boost::shared_ptr< MapKeys<std::string> > keys = boost::make_shared< MapKeys<std::string> >();
+            std::mt19937_64 rng(42);
+            char symbol[32];
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                snprintf(symbol, sizeof(symbol), "SYM%06zu.X", i);
+                keys->m_keys.push_back(symbol);
+            }
+            for (std::size_t i = 0; i < MapKeys<std::string>::LOOKUPS; ++i)
+                keys->m_hits.push_back(keys->m_keys[rng() % keys->m_keys.size()]);
+            return keys;
+        }
+
+        // ===========================================================================================
+        template<class Map, class Key>
+        static void add_lookups(Registry& registry, const std::string& name, boost::shared_ptr< MapKeys<Key> > keys, bool misses = true)
+        {
+            boost::shared_ptr<Map> map = boost::make_shared<Map>();
+            for (std::size_t i = 0; i < keys->m_keys.size(); ++i)
+                (*map)[keys->m_keys[i]] = i;
+
+            registry.add("map", name + " find hit", [map, keys](State& state)
+            {
+                std::size_t found = 0;
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                    found += (map->find(keys->m_hits[i & (MapKeys<Key>::LOOKUPS - 1)]) != map->end());
+                do_not_optimize(found);
+            });
+
+            if (misses)
+                registry.add("map", name + " find miss", [map, keys](State& state)
+                {
+                    std::size_t found = 0;
+                    for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                        found += (map->find(keys->m_misses[i & (MapKeys<Key>::LOOKUPS - 1)]) != map->end());
+                    do_not_optimize(found);
+                });
+
+            registry.add("map", name + " insert+erase", [map, keys](State& state)
+            {
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    const Key& key = keys->m_keys[i % keys->m_keys.size()];
+                    map->erase(key);
+                    (*map)[key] = i;
+                }
+            });
+        }
+
+        // ===========================================================================================
+        void register_types(Registry& registry)
+        {
+            registry.add("ids", "generate_uuid_v4", [](State& state)
+            {
+                uuid_t id;
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    chaos::generate_uuid_v4(id);
+                    do_not_optimize(id);
+                }
+            }, MULTI_THREAD);
+
+            registry.add("ids", "generate_uuid_v7", [](State& state)
+            {
+                uuid_t id;
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    chaos::generate_uuid_v7(id);
+                    do_not_optimize(id);
+                }
+            }, MULTI_THREAD);
+
+            registry.add("ids", "libuuid uuid_generate_time_safe", [](State& state)
+            {
+                uuid_t id;
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    uuid_generate_time_safe(id);
+                    do_not_optimize(id);
+                }
+            }, MULTI_THREAD);
+
+            registry.add("ids", "format_uuid", [](State& state)
+            {
+                uuid_t id;
+                chaos::generate_uuid_v4(id);
+                char text[chaos::UUID_STRING_SIZE];
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    id[15] = static_cast<unsigned char>(i);
+                    chaos::format_uuid(id, text);
+                    do_not_optimize(text);
+                }
+            });
+
+            registry.add("ids", "libuuid uuid_unparse_lower", [](State& state)
+            {
+                uuid_t id;
+                chaos::generate_uuid_v4(id);
+                char text[chaos::UUID_STRING_SIZE];
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    id[15] = static_cast<unsigned char>(i);
+                    uuid_unparse_lower(id, text);
+                    do_not_optimize(text);
+                }
+            });
+
+            registry.add("ids", "generate_uuid_string", [](State& state)
+            {
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    std::string id = chaos::generate_uuid_string();
+                    do_not_optimize(id);
+                }
+            });
+
+            registry.add("ids", "UniqueId::next", [](State& state)
+            {
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                    do_not_optimize(chaos::UniqueId::next());
+            }, MULTI_THREAD);
+
+            // ---------------------------------------------------------------------------------------
+            registry.add("types", "FixedDecimal::from_string", [](State& state)
+            {
+                const std::string prices[4] = { "1.23456", "-0.00125", "104250.5", "0.9" };
+                chaos::FixedDecimal value;
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    value.from_string(prices[i & 3]);
+                    do_not_optimize(value);
+                }
+            });
+
+            registry.add("types", "FixedString<80> assign+copy_to", [](State& state)
+            {
+                const std::string name = "TRADER_12.london.primary";
+                chaos::FixedString<SIZE_80> field;
+                char wire[SIZE_80];
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    field = name;
+                    field.copy_to(wire);
+                    do_not_optimize(wire);
+                }
+            });
+
+            registry.add("types", "strncpy char[80]", [](State& state)
+            {
+                const std::string name = "TRADER_12.london.primary";
+                char wire[SIZE_80];
+                for (std::uint64_t i = 0; i < state.m_iterations; ++i)
+                {
+                    strncpy(wire, name.c_str(), sizeof(wire) - 1);
+                    wire[sizeof(wire) - 1] = 0;
+                    do_not_optimize(wire);
+                }
+            });
+
+            // ---------------------------------------------------------------------------------------
+            boost::shared_ptr< MapKeys<std::uint64_t> > integers = integer_keys();
+            add_lookups< chaos::FlatHashMap<std::uint64_t, std::uint64_t> >(registry, "FlatHashMap<u64>", integers);
+            add_lookups< std::unordered_map<std::uint64_t, std::uint64_t> >(registry, "unordered_map<u64>", integers);
+            add_lookups< std::map<std::uint64_t, std::uint64_t> >(registry, "map<u64>", integers);
+
+            // Symbols as the key, the FixedString keys are built up front like a decoded wire field
+            boost::shared_ptr< MapKeys<std::string> > symbols = symbol_keys(10000);
+            boost::shared_ptr< MapKeys< chaos::FixedString<16> > > fixed = boost::make_shared< MapKeys< chaos::FixedString<16> > >();
+            fixed->m_keys.assign(symbols->m_keys.begin(), symbols->m_keys.end());
+            fixed->m_hits.assign(symbols->m_hits.begin(), symbols->m_hits.end());
+            add_lookups< chaos::FlatHashMap<chaos::FixedString<16>, std::uint64_t> >(registry, "FlatHashMap<FixedString<16>>", fixed, false);
+            add_lookups< std::unordered_map<std::string, std::uint64_t> >(registry, "unordered_map<string>", symbols, false);
+        }
+    }
+} // End of namespace
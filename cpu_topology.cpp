@@ -0,0 +1,265 @@
+// CPU topology discovery and NUMA aware placement of threads and memory
+//
+// Copyright HOLM, 2023
+
+#include "pch.h"
+#include "cpu_topology.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#ifndef WIN32
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Values from linux/mempolicy.h, we call mbind directly rather than pull in libnuma
+#define CHAOS_MPOL_BIND     2
+#define CHAOS_MPOL_LOCAL    4
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    CpuTopology::CpuTopology(const std::string& sysfs) :
+        m_sysfs(sysfs),
+        m_node_count(1)
+    {
+        discover();
+    }
+
+    // ===============================================================================================
+    void CpuTopology::parse_cpu_list(const std::string& list, std::vector<std::int32_t>& cpus)
+    {
+        // The kernel format is a comma separated list of ranges, e.g. 0-3,8,10-11
+        std::stringstream ss(list);
+        std::string item;
+        while (std::getline(ss, item, ','))
+        {
+            if (item.empty() || item == "\n")
+                continue;
+
+            std::size_t dash = item.find('-');
+            std::int32_t first = atoi(item.substr(0, dash).c_str());
+            std::int32_t last = (dash == std::string::npos) ? first : atoi(item.substr(dash + 1).c_str());
+            for (std::int32_t cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+    }
+
+    // ===============================================================================================
+    std::string CpuTopology::read_line(const std::string& path)
+    {
+        std::ifstream in(path.c_str());
+        std::string line;
+        if (in.is_open())
+            std::getline(in, line);
+        return line;
+    }
+
+    // ===============================================================================================
+    std::int32_t CpuTopology::read_int(const std::string& path, std::int32_t def)
+    {
+        std::string line = read_line(path);
+        return line.empty() ? def : atoi(line.c_str());
+    }
+
+    // ===============================================================================================
+    void CpuTopology::discover()
+    {
+        std::string cpu_dir = m_sysfs + "/devices/system/cpu/";
+        std::string node_dir = m_sysfs + "/devices/system/node/";
+
+        std::vector<std::int32_t> online;
+        parse_cpu_list(read_line(cpu_dir + "online"), online);
+        if (online.empty())
+        {
+            // No sysfs, fall back to what the C library can tell us
+#ifndef WIN32
+            long count = sysconf(_SC_NPROCESSORS_ONLN);
+            for (long i = 0; i < count; ++i)
+                online.push_back(static_cast<std::int32_t>(i));
+#endif
+        }
+
+        std::vector<std::int32_t> isolated;
+        parse_cpu_list(read_line(cpu_dir + "isolated"), isolated);
+
+        for (std::size_t i = 0; i < online.size(); ++i)
+        {
+            std::stringstream ss;
+            ss << cpu_dir << "cpu" << online[i] << "/topology/";
+
+            CpuInfo info;
+            info.m_cpu = online[i];
+            info.m_core = read_int(ss.str() + "core_id", online[i]);
+            info.m_package = read_int(ss.str() + "physical_package_id", 0);
+            info.m_node = 0;
+            info.m_isolated = (std::find(isolated.begin(), isolated.end(), online[i]) != isolated.end());
+            parse_cpu_list(read_line(ss.str() + "thread_siblings_list"), info.m_siblings);
+            m_cpus.push_back(info);
+        }
+
+        // Map every cpu to its NUMA node
+        std::vector<std::int32_t> nodes;
+        parse_cpu_list(read_line(node_dir + "online"), nodes);
+        if (!nodes.empty())
+            m_node_count = static_cast<std::int32_t>(nodes.size());
+
+        for (std::size_t n = 0; n < nodes.size(); ++n)
+        {
+            std::stringstream ss;
+            ss << node_dir << "node" << nodes[n] << "/cpulist";
+
+            std::vector<std::int32_t> cpus;
+            parse_cpu_list(read_line(ss.str()), cpus);
+            for (std::size_t i = 0; i < m_cpus.size(); ++i)
+            {
+                if (std::find(cpus.begin(), cpus.end(), m_cpus[i].m_cpu) != cpus.end())
+                    m_cpus[i].m_node = nodes[n];
+            }
+        }
+    }
+
+    // ===============================================================================================
+    std::int32_t CpuTopology::get_node_of_cpu(std::int32_t cpu)
+    {
+        for (std::size_t i = 0; i < m_cpus.size(); ++i)
+        {
+            if (m_cpus[i].m_cpu == cpu)
+                return m_cpus[i].m_node;
+        }
+        return -1;
+    }
+
+    // ===============================================================================================
+    std::int32_t CpuTopology::get_nic_node(const std::string& nic)
+    {
+        std::string name = nic;
+
+#ifndef WIN32
+        // An address rather than a name, find the interface that owns it
+        in_addr addr;
+        if (inet_pton(AF_INET, nic.c_str(), &addr) == 1)
+        {
+            name.clear();
+            ifaddrs* list = NULL;
+            if (getifaddrs(&list) == 0)
+            {
+                for (ifaddrs* it = list; it != NULL; it = it->ifa_next)
+                {
+                    if (it->ifa_addr && it->ifa_addr->sa_family == AF_INET &&
+                        reinterpret_cast<sockaddr_in*>(it->ifa_addr)->sin_addr.s_addr == addr.s_addr)
+                    {
+                        name = it->ifa_name;
+                        break;
+                    }
+                }
+                freeifaddrs(list);
+            }
+        }
+#endif
+
+        if (name.empty())
+            return -1;
+
+        return read_int(m_sysfs + "/class/net/" + name + "/device/numa_node", -1);
+    }
+
+    // ===============================================================================================
+    std::vector<std::int32_t> CpuTopology::select_cores(std::size_t count, std::uint32_t policy, const std::string& nic)
+    {
+        std::int32_t nic_node = ((policy & PP_NicLocal) && !nic.empty()) ? get_nic_node(nic) : -1;
+
+        std::vector<CpuInfo> cpus(m_cpus);
+        std::sort(cpus.begin(), cpus.end(), [](const CpuInfo& a, const CpuInfo& b)
+        {
+            if (a.m_node != b.m_node)
+                return a.m_node < b.m_node;
+            if (a.m_package != b.m_package)
+                return a.m_package < b.m_package;
+            if (a.m_core != b.m_core)
+                return a.m_core < b.m_core;
+            return a.m_cpu < b.m_cpu;
+        });
+
+        std::vector<std::int32_t> selected;
+        std::set<std::pair<std::int32_t, std::int32_t> > used_cores;
+        for (std::size_t i = 0; i < cpus.size() && selected.size() < count; ++i)
+        {
+            const CpuInfo& cpu = cpus[i];
+            if ((policy & PP_SkipCpuZero) && cpu.m_cpu == 0)
+                continue;
+            if ((policy & PP_Isolated) && !cpu.m_isolated)
+                continue;
+            if (nic_node >= 0 && cpu.m_node != nic_node)
+                continue;
+            if ((policy & PP_AvoidSiblings) && !used_cores.insert(std::make_pair(cpu.m_package, cpu.m_core)).second)
+                continue;
+
+            selected.push_back(cpu.m_cpu);
+        }
+        return selected;
+    }
+
+    // ===============================================================================================
+    std::string CpuTopology::to_string()
+    {
+        std::stringstream ss;
+        ss << "nodes=" << m_node_count << " cpus=" << m_cpus.size();
+        for (std::size_t i = 0; i < m_cpus.size(); ++i)
+        {
+            ss << " [cpu=" << m_cpus[i].m_cpu << " core=" << m_cpus[i].m_core << " package=" << m_cpus[i].m_package
+               << " node=" << m_cpus[i].m_node << (m_cpus[i].m_isolated ? " isolated" : "") << "]";
+        }
+        return ss.str();
+    }
+
+    // ===============================================================================================
+    void* CpuTopology::allocate_on_node(std::size_t size, std::int32_t node)
+    {
+#ifndef WIN32
+        void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+
+        // If the policy can't be set (no NUMA support, or too old a kernel for MPOL_LOCAL) the
+        // memory still lands on the node of the thread that touches it first, which is us
+        unsigned long mask = 0;
+        if (node >= 0 && node < static_cast<std::int32_t>(sizeof(mask) * 8))
+        {
+            mask = 1UL << node;
+            syscall(SYS_mbind, p, size, CHAOS_MPOL_BIND, &mask, sizeof(mask) * 8 + 1, 0);
+        }
+        else
+            syscall(SYS_mbind, p, size, CHAOS_MPOL_LOCAL, NULL, 0, 0);
+
+        memset(p, 0, size);
+        return p;
+#else
+        return malloc(size);
+#endif
+    }
+
+    // ===============================================================================================
+    void CpuTopology::free_on_node(void* p, std::size_t size)
+    {
+        if (!p)
+            return;
+#ifndef WIN32
+        munmap(p, size);
+#else
+        free(p);
+#endif
+    }
+
+    // ===============================================================================================
+} // End of namespace
@@ -0,0 +1,78 @@
+// CPU topology discovery and NUMA aware placement of threads and memory
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    // Placement policies for select_cores(), they can be combined
+    enum PlacementPolicy
+    {
+        PP_Any              = 0,
+        PP_AvoidSiblings    = 1,    // One logical cpu per physical core, the SMT sibling stays idle
+        PP_Isolated         = 2,    // Only cpus listed in isolcpus
+        PP_NicLocal         = 4,    // Only cpus on the same NUMA node as the NIC
+        PP_SkipCpuZero      = 8     // Leave cpu 0 for the kernel and housekeeping
+    };
+
+    // ===============================================================================================
+    struct CpuInfo
+    {
+        std::int32_t                m_cpu;
+        std::int32_t                m_core;
+        std::int32_t                m_package;
+        std::int32_t                m_node;
+        bool                        m_isolated;
+        std::vector<std::int32_t>   m_siblings;
+    };
+
+    // ===============================================================================================
+    // Reads the layout of the box from sysfs so deployments can ask for "4 isolated physical
+    // cores next to eth2" instead of hard coding core numbers per machine. The result feeds
+    // straight into pin_thread_to_core() or the ThreadPool core list.
+    class CpuTopology
+    {
+    public:
+        CpuTopology(const std::string& sysfs = "/sys");
+        virtual ~CpuTopology() {}
+
+        const std::vector<CpuInfo>& get_cpus() { return m_cpus; }
+        std::int32_t get_node_count() { return m_node_count; }
+        std::int32_t get_node_of_cpu(std::int32_t cpu);
+
+        // The nic can be an interface name (eth0) or the address of one, like the nic passed to
+        // Udp. Returns -1 if the node isn't known, which is the case on single node boxes.
+        std::int32_t get_nic_node(const std::string& nic);
+
+        // Returns up to count cpus that satisfy the policy, ordered by node, package and core
+        std::vector<std::int32_t> select_cores(std::size_t count, std::uint32_t policy, const std::string& nic = "");
+
+        std::string to_string();
+
+        // Memory bound to a NUMA node, the pages are touched up front so they are resident
+        // before the hot path uses them. A node of -1 binds to the node of the calling thread,
+        // which is what you want for a buffer allocated by a pinned thread for its own use.
+        static void* allocate_on_node(std::size_t size, std::int32_t node);
+        static void* allocate_local(std::size_t size) { return allocate_on_node(size, -1); }
+        static void free_on_node(void* p, std::size_t size);
+
+        static void parse_cpu_list(const std::string& list, std::vector<std::int32_t>& cpus);
+
+    private:
+        void discover();
+        std::string read_line(const std::string& path);
+        std::int32_t read_int(const std::string& path, std::int32_t def);
+
+        std::string                 m_sysfs;
+        std::vector<CpuInfo>        m_cpus;
+        std::int32_t                m_node_count;
+
+    };
+} // End of namespace
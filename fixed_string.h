@@ -0,0 +1,142 @@
+// Fixed capacity string with inline storage for message fields
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    // N is the size of the char array it stands in for, so it holds up to N - 1 characters and a
+    // terminator. The characters live inline, the length is tracked and everything past it is
+    // kept zeroed, which means
+    //
+    //      - copying one is a plain memcpy, it is trivially copyable and can go through a SeqLock
+    //      - copy_to() fills a wire field of the same size with one memcpy, no strlen
+    //      - hashing and comparing are whole words
+    //
+    // Anything that doesn't fit is truncated rather than overflowing, assign() says when it was.
+    template<std::size_t N>
+    class FixedString
+    {
+    public:
+        static const std::size_t CAPACITY = N - 1;
+
+        FixedString() : m_length(0) { memset(m_data, 0, N); }
+        FixedString(const char* s) { assign(s); }
+        FixedString(const char* s, std::size_t length) { assign(s, length); }
+        FixedString(const std::string& s) { assign(s.data(), s.size()); }
+
+        template<std::size_t M>
+        FixedString(const FixedString<M>& other) { assign(other.data(), other.size()); }
+
+        // Wire fields aren't necessarily terminated, the scan stops at the end of the field
+        template<std::size_t M>
+        static FixedString from_wire(const char (&field)[M]) { return FixedString(field, strnlen(field, M)); }
+
+        // ===========================================================================================
+        bool assign(const char* s, std::size_t length)
+        {
+            std::size_t copy = (length < CAPACITY) ? length : CAPACITY;
+            memcpy(m_data, s, copy);
+            memset(m_data + copy, 0, N - copy);
+            m_length = static_cast<std::uint32_t>(copy);
+            return copy == length;
+        }
+
+        // Scans at most N so a longer string still reports the truncation, a loop because
+        // strnlen(s, N) is flagged as an over-read when s is a shorter literal
+        bool assign(const char* s)
+        {
+            std::size_t length = 0;
+            if (s)
+            {
+                while (length < N && s[length] != 0)
+                    ++length;
+            }
+            return assign(s, length);
+        }
+
+        bool assign(const std::string& s) { return assign(s.data(), s.size()); }
+
+        FixedString& operator=(const char* s) { assign(s); return *this; }
+        FixedString& operator=(const std::string& s) { assign(s.data(), s.size()); return *this; }
+
+        bool append(const char* s, std::size_t length)
+        {
+            std::size_t room = CAPACITY - m_length;
+            std::size_t copy = (length < room) ? length : room;
+            memcpy(m_data + m_length, s, copy);
+            m_length += static_cast<std::uint32_t>(copy);
+            return copy == length;
+        }
+
+        void clear()
+        {
+            memset(m_data, 0, m_length);
+            m_length = 0;
+        }
+
+        // ===========================================================================================
+        // Straight into a wire field, the whole field is written so it ends up terminated and padded
+        void copy_to(char (&field)[N]) const { memcpy(field, m_data, N); }
+
+        template<std::size_t M>
+        void copy_to(char (&field)[M]) const
+        {
+            std::size_t copy = (m_length < M - 1) ? m_length : M - 1;
+            memcpy(field, m_data, copy);
+            memset(field + copy, 0, M - copy);
+        }
+
+        // ===========================================================================================
+        const char* c_str() const { return m_data; }
+        const char* data() const { return m_data; }
+        std::size_t size() const { return m_length; }
+        std::size_t length() const { return m_length; }
+        bool empty() const { return m_length == 0; }
+        static std::size_t capacity() { return CAPACITY; }
+        std::string to_string() const { return std::string(m_data, m_length); }
+
+        char operator[](std::size_t i) const { return m_data[i]; }
+
+        bool operator==(const FixedString& other) const { return m_length == other.m_length && memcmp(m_data, other.m_data, m_length) == 0; }
+        bool operator!=(const FixedString& other) const { return !(*this == other); }
+        bool operator<(const FixedString& other) const { return strcmp(m_data, other.m_data) < 0; }
+
+        // ===========================================================================================
+        std::size_t hash() const
+        {
+            // The padding is zero so the bytes past the length can be hashed along with the rest
+            std::uint64_t h = m_length;
+            std::size_t i = 0;
+            for (; i + 8 <= N; i += 8)
+            {
+                std::uint64_t word;
+                memcpy(&word, m_data + i, sizeof(word));
+                h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+            }
+            for (; i < N; ++i)
+                h = (h ^ static_cast<unsigned char>(m_data[i])) * 0x100000001b3ULL;
+            return h ^ (h >> 29);
+        }
+
+    private:
+        char            m_data[N];
+        std::uint32_t   m_length;
+
+    };
+
+    // ===============================================================================================
+    template<std::size_t N>
+    std::ostream& operator<<(std::ostream& os, const FixedString<N>& s)
+    {
+        return os.write(s.data(), s.size());
+    }
+} // End of namespace
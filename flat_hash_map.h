@@ -0,0 +1,454 @@
+// Open addressing hash map with SIMD group probing
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include "fixed_string.h"
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <uuid/uuid.h>
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    namespace flat_hash
+    {
+        static const std::size_t    GROUP_SIZE = 16;
+
+        // A control byte per slot, the low 7 bits of the hash when the slot is full
+        static const std::int8_t    CTRL_EMPTY = -128;
+        static const std::int8_t    CTRL_DELETED = -2;
+        static const std::int8_t    CTRL_SENTINEL = -1;
+
+        // ===========================================================================================
+        static inline std::uint64_t mix(std::uint64_t h)
+        {
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h;
+        }
+
+        // ===========================================================================================
+        static inline std::uint64_t load64(const void* p)
+        {
+            std::uint64_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        // ===========================================================================================
+        // The bitmasks of the 16 control bytes starting at ctrl that match a condition
+        struct Group
+        {
+#ifdef __SSE2__
+            __m128i m_ctrl;
+
+            explicit Group(const std::int8_t* ctrl) : m_ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))) {}
+
+            std::uint32_t match(std::int8_t h2) const { return _mm_movemask_epi8(_mm_cmpeq_epi8(m_ctrl, _mm_set1_epi8(h2))); }
+            std::uint32_t match_empty() const { return match(CTRL_EMPTY); }
+            std::uint32_t match_empty_or_deleted() const { return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(CTRL_SENTINEL), m_ctrl)); }
+#else
+            const std::int8_t* m_ctrl;
+
+            explicit Group(const std::int8_t* ctrl) : m_ctrl(ctrl) {}
+
+            std::uint32_t match(std::int8_t h2) const
+            {
+                std::uint32_t bits = 0;
+                for (std::size_t i = 0; i < GROUP_SIZE; ++i)
+                    bits |= static_cast<std::uint32_t>(m_ctrl[i] == h2) << i;
+                return bits;
+            }
+            std::uint32_t match_empty() const { return match(CTRL_EMPTY); }
+            std::uint32_t match_empty_or_deleted() const
+            {
+                std::uint32_t bits = 0;
+                for (std::size_t i = 0; i < GROUP_SIZE; ++i)
+                    bits |= static_cast<std::uint32_t>(m_ctrl[i] < CTRL_SENTINEL) << i;
+                return bits;
+            }
+#endif
+        };
+    }
+
+    // ===============================================================================================
+    // A uuid_t as a value type so it can be a key, the 16 bytes live inline in the slot
+    struct UuidKey
+    {
+        unsigned char   m_bytes[16];
+
+        UuidKey() { memset(m_bytes, 0, sizeof(m_bytes)); }
+        UuidKey(const uuid_t& id) { memcpy(m_bytes, id, sizeof(m_bytes)); }
+
+        bool operator==(const UuidKey& other) const { return memcmp(m_bytes, other.m_bytes, sizeof(m_bytes)) == 0; }
+        bool operator!=(const UuidKey& other) const { return !(*this == other); }
+
+        std::size_t hash() const
+        {
+            // v4 and v7 ids are mostly random already, mixing the two halves is plenty
+            return flat_hash::mix(flat_hash::load64(m_bytes) ^ (flat_hash::load64(m_bytes + 8) * 0x9e3779b97f4a7c15ULL));
+        }
+    };
+
+    // ===============================================================================================
+    // std::hash for integers is the identity, the map needs the low 7 bits and the high bits to
+    // be independent so everything goes through a finalizer. Keys with a hash() member use it.
+    template<class Key>
+    struct FlatHash
+    {
+        std::size_t operator()(const Key& key) const { return flat_hash::mix(std::hash<Key>()(key)); }
+    };
+
+    template<>
+    struct FlatHash<UuidKey>
+    {
+        std::size_t operator()(const UuidKey& key) const { return key.hash(); }
+    };
+
+    // The padding is zero so equal strings hash the same whole words, see fixed_string.h
+    template<std::size_t N>
+    struct FlatHash< FixedString<N> >
+    {
+        std::size_t operator()(const FixedString<N>& key) const { return flat_hash::mix(key.hash()); }
+    };
+
+    // ===============================================================================================
+    // Swiss table layout, a byte of control per slot and the slots in a separate array. A lookup
+    // loads 16 control bytes at a time, compares all of them with the 7 bit tag of the hash in
+    // one instruction and only touches the slots whose tag matched, so a miss usually costs one
+    // cache line of control bytes and no key comparison at all. The table stays under 7/8 full,
+    // erase leaves a tombstone that the next insert on the same probe path reuses.
+    //
+    // Iterators and pointers are invalidated by any insert that grows the table.
+    template<class Key, class Value, class Hash = FlatHash<Key>, class Equal = std::equal_to<Key> >
+    class FlatHashMap
+    {
+    public:
+        typedef std::pair<Key, Value>   value_type;
+
+        // ===========================================================================================
+        class iterator
+        {
+        public:
+            iterator() : m_map(NULL), m_index(0) {}
+            iterator(FlatHashMap* map, std::size_t index) : m_map(map), m_index(index) { skip(); }
+
+            value_type& operator*() const { return m_map->m_slots[m_index]; }
+            value_type* operator->() const { return &m_map->m_slots[m_index]; }
+
+            iterator& operator++()
+            {
+                ++m_index;
+                skip();
+                return *this;
+            }
+
+            bool operator==(const iterator& other) const { return m_index == other.m_index; }
+            bool operator!=(const iterator& other) const { return m_index != other.m_index; }
+
+        private:
+            void skip()
+            {
+                while (m_index < m_map->m_capacity && m_map->m_ctrl[m_index] < 0)
+                    ++m_index;
+            }
+
+            FlatHashMap*    m_map;
+            std::size_t     m_index;
+
+            friend class FlatHashMap;
+        };
+
+        // ===========================================================================================
+        FlatHashMap() : m_ctrl(NULL), m_slots(NULL), m_capacity(0), m_size(0), m_growth_left(0) {}
+
+        explicit FlatHashMap(std::size_t expected) : m_ctrl(NULL), m_slots(NULL), m_capacity(0), m_size(0), m_growth_left(0)
+        {
+            reserve(expected);
+        }
+
+        FlatHashMap(const FlatHashMap& other) : m_ctrl(NULL), m_slots(NULL), m_capacity(0), m_size(0), m_growth_left(0)
+        {
+            reserve(other.m_size);
+            for (std::size_t i = 0; i < other.m_capacity; ++i)
+            {
+                if (other.m_ctrl[i] >= 0)
+                    insert(other.m_slots[i].first, other.m_slots[i].second);
+            }
+        }
+
+        FlatHashMap& operator=(FlatHashMap other)
+        {
+            swap(other);
+            return *this;
+        }
+
+        ~FlatHashMap()
+        {
+            destroy();
+        }
+
+        void swap(FlatHashMap& other)
+        {
+            std::swap(m_ctrl, other.m_ctrl);
+            std::swap(m_slots, other.m_slots);
+            std::swap(m_capacity, other.m_capacity);
+            std::swap(m_size, other.m_size);
+            std::swap(m_growth_left, other.m_growth_left);
+        }
+
+        iterator begin() { return iterator(this, 0); }
+        iterator end() { return iterator(this, m_capacity); }
+
+        std::size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+        std::size_t capacity() const { return m_capacity; }
+
+        // ===========================================================================================
+        iterator find(const Key& key)
+        {
+            std::size_t index = find_index(key);
+            return (index == NPOS) ? end() : iterator(this, index);
+        }
+
+        bool contains(const Key& key) { return find_index(key) != NPOS; }
+        std::size_t count(const Key& key) { return contains(key) ? 1 : 0; }
+
+        // Null if the key isn't there, the cheapest lookup
+        Value* find_value(const Key& key)
+        {
+            std::size_t index = find_index(key);
+            return (index == NPOS) ? NULL : &m_slots[index].second;
+        }
+
+        // ===========================================================================================
+        // Leaves the value alone if the key is already there
+        std::pair<iterator, bool> insert(const Key& key, const Value& value)
+        {
+            std::size_t hash;
+            std::pair<std::size_t, bool> slot = prepare_insert(key, hash);
+            if (slot.second)
+            {
+                new (&m_slots[slot.first]) value_type(key, value);
+                finish_insert(slot.first, hash);
+            }
+            return std::make_pair(iterator(this, slot.first), slot.second);
+        }
+
+        Value& operator[](const Key& key)
+        {
+            std::size_t hash;
+            std::pair<std::size_t, bool> slot = prepare_insert(key, hash);
+            if (slot.second)
+            {
+                new (&m_slots[slot.first]) value_type(key, Value());
+                finish_insert(slot.first, hash);
+            }
+            return m_slots[slot.first].second;
+        }
+
+        // ===========================================================================================
+        bool erase(const Key& key)
+        {
+            std::size_t index = find_index(key);
+            if (index == NPOS)
+                return false;
+            erase_index(index);
+            return true;
+        }
+
+        void erase(iterator it)
+        {
+            erase_index(it.m_index);
+        }
+
+        // ===========================================================================================
+        void clear()
+        {
+            for (std::size_t i = 0; i < m_capacity; ++i)
+            {
+                if (m_ctrl[i] >= 0)
+                    m_slots[i].~value_type();
+            }
+            if (m_capacity)
+                memset(m_ctrl, flat_hash::CTRL_EMPTY, m_capacity + flat_hash::GROUP_SIZE);
+            m_size = 0;
+            m_growth_left = max_load(m_capacity);
+        }
+
+        void reserve(std::size_t expected)
+        {
+            std::size_t capacity = flat_hash::GROUP_SIZE;
+            while (max_load(capacity) < expected)
+                capacity <<= 1;
+            if (capacity > m_capacity)
+                rehash(capacity);
+        }
+
+    private:
+        static const std::size_t NPOS = static_cast<std::size_t>(-1);
+
+        static std::size_t max_load(std::size_t capacity) { return capacity - capacity / 8; }
+
+        static std::size_t h1(std::size_t hash) { return hash >> 7; }
+        static std::int8_t h2(std::size_t hash) { return static_cast<std::int8_t>(hash & 0x7f); }
+
+        // ===========================================================================================
+        void set_ctrl(std::size_t index, std::int8_t value)
+        {
+            // The first group is mirrored after the end so a load near the end never wraps
+            m_ctrl[index] = value;
+            if (index < flat_hash::GROUP_SIZE)
+                m_ctrl[m_capacity + index] = value;
+        }
+
+        // ===========================================================================================
+        std::size_t find_index(const Key& key)
+        {
+            return (m_size == 0) ? NPOS : find_index(key, m_hash(key));
+        }
+
+        std::size_t find_index(const Key& key, std::size_t hash)
+        {
+            std::size_t mask = m_capacity - 1;
+            std::size_t pos = h1(hash) & mask;
+            for (std::size_t step = flat_hash::GROUP_SIZE; ; step += flat_hash::GROUP_SIZE)
+            {
+                flat_hash::Group group(m_ctrl + pos);
+                for (std::uint32_t bits = group.match(h2(hash)); bits; bits &= bits - 1)
+                {
+                    std::size_t index = (pos + __builtin_ctz(bits)) & mask;
+                    if (m_equal(m_slots[index].first, key))
+                        return index;
+                }
+                if (group.match_empty())
+                    return NPOS;
+                pos = (pos + step) & mask;
+            }
+        }
+
+        // ===========================================================================================
+        // The first empty or deleted slot on the probe path of hash
+        std::size_t find_free(std::size_t hash)
+        {
+            std::size_t mask = m_capacity - 1;
+            std::size_t pos = h1(hash) & mask;
+            for (std::size_t step = flat_hash::GROUP_SIZE; ; step += flat_hash::GROUP_SIZE)
+            {
+                std::uint32_t bits = flat_hash::Group(m_ctrl + pos).match_empty_or_deleted();
+                if (bits)
+                    return (pos + __builtin_ctz(bits)) & mask;
+                pos = (pos + step) & mask;
+            }
+        }
+
+        // ===========================================================================================
+        // Returns the slot of the key and false if it is already there, otherwise a free slot and
+        // true. The caller constructs the value there and only then calls finish_insert(), so a
+        // constructor that throws leaves the map as it was.
+        std::pair<std::size_t, bool> prepare_insert(const Key& key, std::size_t& hash)
+        {
+            hash = m_hash(key);
+            std::size_t index = (m_size == 0) ? NPOS : find_index(key, hash);
+            if (index != NPOS)
+                return std::make_pair(index, false);
+
+            if (m_capacity == 0)
+                rehash(flat_hash::GROUP_SIZE);
+
+            index = find_free(hash);
+            if (m_growth_left == 0 && m_ctrl[index] == flat_hash::CTRL_EMPTY)
+            {
+                // Out of room, if it's mostly tombstones a same size rehash is enough
+                rehash(m_size * 2 < max_load(m_capacity) ? m_capacity : m_capacity * 2);
+                index = find_free(hash);
+            }
+            return std::make_pair(index, true);
+        }
+
+        void finish_insert(std::size_t index, std::size_t hash)
+        {
+            if (m_ctrl[index] == flat_hash::CTRL_EMPTY)
+                --m_growth_left;
+            set_ctrl(index, h2(hash));
+            ++m_size;
+        }
+
+        // ===========================================================================================
+        void erase_index(std::size_t index)
+        {
+            m_slots[index].~value_type();
+            set_ctrl(index, flat_hash::CTRL_DELETED);
+            --m_size;
+        }
+
+        // ===========================================================================================
+        void rehash(std::size_t capacity)
+        {
+            std::int8_t* old_ctrl = m_ctrl;
+            value_type* old_slots = m_slots;
+            std::size_t old_capacity = m_capacity;
+
+            m_ctrl = new std::int8_t[capacity + flat_hash::GROUP_SIZE];
+            memset(m_ctrl, flat_hash::CTRL_EMPTY, capacity + flat_hash::GROUP_SIZE);
+            m_slots = static_cast<value_type*>(::operator new(capacity * sizeof(value_type)));
+            m_capacity = capacity;
+            m_growth_left = max_load(capacity) - m_size;
+
+            for (std::size_t i = 0; i < old_capacity; ++i)
+            {
+                if (old_ctrl[i] < 0)
+                    continue;
+
+                std::size_t hash = m_hash(old_slots[i].first);
+                std::size_t index = find_free(hash);
+                set_ctrl(index, h2(hash));
+                new (&m_slots[index]) value_type(std::move(old_slots[i]));
+                old_slots[i].~value_type();
+            }
+
+            delete[] old_ctrl;
+            ::operator delete(old_slots);
+        }
+
+        // ===========================================================================================
+        void destroy()
+        {
+            for (std::size_t i = 0; i < m_capacity; ++i)
+            {
+                if (m_ctrl[i] >= 0)
+                    m_slots[i].~value_type();
+            }
+            delete[] m_ctrl;
+            ::operator delete(m_slots);
+            m_ctrl = NULL;
+            m_slots = NULL;
+            m_capacity = m_size = m_growth_left = 0;
+        }
+
+        std::int8_t*    m_ctrl;
+        value_type*     m_slots;
+        std::size_t     m_capacity;
+        std::size_t     m_size;
+        std::size_t     m_growth_left;
+        Hash            m_hash;
+        Equal           m_equal;
+
+    };
+} // End of namespace
@@ -0,0 +1,93 @@
+// Listens for CONTROL messages from mother and applies them to the logger
+//
+// Copyright HOLM, 2023
+
+#include "pch.h"
+#include "log_control.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <sstream>
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    LogControl::LogControl(boost::asio::io_service& io, const std::string& addr, std::uint16_t port,
+                           const std::string& application, const std::string& instance) :
+        Udp(true, io, addr, port, true, true),
+        m_application(application),
+        m_instance(instance),
+        m_retry(io),
+        m_retry_ms(0)
+    {
+        // Started once we are fully constructed so the first message reaches our on_message
+        start();
+    }
+
+    // ===============================================================================================
+    bool LogControl::is_for_us(const chaos::MSG_CONTROL& control)
+    {
+        // The names are fixed size fields from the wire, they may not be terminated
+        std::string application(control.m_application, strnlen(control.m_application, sizeof(control.m_application)));
+        std::string instance(control.m_instance, strnlen(control.m_instance, sizeof(control.m_instance)));
+
+        return (application.empty() || application == m_application) && (instance.empty() || instance == m_instance);
+    }
+
+    // ===============================================================================================
+    void LogControl::on_message(const boost::system::error_code& error, size_t bytes_recvd)
+    {
+        if (error == boost::asio::error::operation_aborted)
+            return;
+
+        if (error)
+        {
+            m_retry_ms = (m_retry_ms == 0) ? 100 : std::min<std::int64_t>(m_retry_ms * 2, 10000);
+
+            std::stringstream ss;
+            ss << "Control receive failed: " << error.message() << ", listening again in " << m_retry_ms << "ms";
+            LOG(ERR_MSG, ss.str());
+
+            m_retry.expires_from_now(boost::posix_time::milliseconds(m_retry_ms));
+            m_retry.async_wait(boost::bind(&LogControl::on_retry, this, boost::asio::placeholders::error));
+            return;
+        }
+        m_retry_ms = 0;
+
+        if (bytes_recvd >= static_cast<size_t>(m_msg.control.getLength()) &&
+            m_msg.header.m_type == chaos::MessageTypes::CONTROL && is_for_us(m_msg.control))
+        {
+            switch (m_msg.control.m_command)
+            {
+            case chaos::ControlCommands::CC_SET_LOG_LEVEL:
+                if (m_msg.control.m_value >= FAT_MSG && m_msg.control.m_value <= DEB_MSG)
+                {
+                    chaos::Logger::set_log_level(m_msg.control.m_value);
+
+                    std::stringstream ss;
+                    ss << "Log level set to " << get_state(m_msg.control.m_value) << " by mother";
+                    LOG(PUB_MSG, ss.str());
+                }
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        // Listen again
+        async_receive();
+    }
+
+    // ===============================================================================================
+    void LogControl::on_retry(const boost::system::error_code& error)
+    {
+        if (error == boost::asio::error::operation_aborted)
+            return;
+
+        async_receive();
+    }
+
+    // ===============================================================================================
+} // End of namespace
@@ -0,0 +1,43 @@
+// Listens for CONTROL messages from mother and applies them to the logger
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include "udp_messages.h"
+#include "udp.h"
+
+#include <string>
+
+#include <boost/asio.hpp>
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    // Joins the mother's multicast group and acts on CONTROL messages addressed to this
+    // application and instance, an empty name in the message matches everybody. Runs on the
+    // logger's io_service so nothing here is on a hot path. A receive error is logged and the
+    // next receive waits, from 100ms doubling up to 10s, so a broken socket can't spin the
+    // io thread.
+    class LogControl : public chaos::Udp
+    {
+    public:
+        LogControl(boost::asio::io_service& io, const std::string& addr, std::uint16_t port,
+                   const std::string& application, const std::string& instance);
+        virtual ~LogControl() {}
+
+    protected:
+        virtual void on_message(const boost::system::error_code& error, size_t bytes_recvd);
+
+    private:
+        bool is_for_us(const chaos::MSG_CONTROL& control);
+        void on_retry(const boost::system::error_code& error);
+
+        std::string                 m_application;
+        std::string                 m_instance;
+        boost::asio::deadline_timer m_retry;
+        std::int64_t                m_retry_ms;
+
+    };
+} // End of namespace
@@ -9,8 +9,11 @@
 #include "wait_free_queue.h"
 #include "time_utils.h"
 #include "application_details.h"
+#include "log_control.h"
 
 #ifndef WIN32
+#include <fcntl.h>
+#include <signal.h>
 #include <unistd.h>
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -24,8 +27,16 @@
 
 #include <iostream>
 #include <fstream>
+#include <cerrno>
+#include <cstring>
 #include <iomanip>
 
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/future.hpp>
+
 // ========================================================================================================
 namespace chaos
 {
@@ -58,24 +69,105 @@ namespace chaos
     }
 
     // ======================================================================================================
-    Logger* Logger::m_instance = 0;
+    std::int32_t Logger::parse_log_level(const std::string& level)
+    {
+        std::string value = boost::algorithm::to_upper_copy(boost::algorithm::trim_copy(level));
+        if (value.empty())
+            return -1;
+
+        if (value.find_first_not_of("0123456789") == std::string::npos)
+        {
+            std::int32_t number = atoi(value.c_str());
+            return (number >= FAT_MSG && number <= DEB_MSG) ? number : -1;
+        }
+
+        if (value == "FAT" || value == "FATAL")
+            return FAT_MSG;
+        if (value == "ERR" || value == "ERROR")
+            return ERR_MSG;
+        if (value == "PUB" || value == "PUBLIC")
+            return PUB_MSG;
+        if (value == "INF" || value == "INFO")
+            return INF_MSG;
+        if (value == "WARN" || value == "WARNING")
+            return WARN_MSG;
+        if (value == "DEB" || value == "DEBUG")
+            return DEB_MSG;
+        return -1;
+    }
+
+    // ======================================================================================================
+    // Both are constant initialised so a LOG() from another file's static constructor sees the
+    // default level, LOG_LEVEL is only read when the logger is created
+    boost::atomic<Logger*> Logger::m_instance(0);
+    boost::atomic<std::int32_t> Logger::m_log_level(DEB_MSG);
+    boost::atomic<bool> Logger::m_log_level_set(false);
     namespace logger
     {
         chaos::SpinLock logLock;
     }
 
     // ======================================================================================================
-    Logger* Logger::instance()
+    boost::atomic<std::uint32_t> LogSite::m_current_epoch(0);
+    boost::atomic<std::uint32_t> LogSite::m_limit(100);
+    boost::atomic<LogSite*> LogSite::m_sites(0);
+
+    // ======================================================================================================
+    LogSite::LogSite(const char* file, std::int32_t line) :
+        m_file(file),
+        m_line(line),
+        m_state(0),
+        m_epoch(m_current_epoch.load(boost::memory_order_relaxed)),
+        m_count(0),
+        m_suppressed(0),
+        m_next(0)
+    {
+        // Sites are function statics so they are never removed, pushing on the front is all we need
+        LogSite* head = m_sites.load(boost::memory_order_relaxed);
+        do
+        {
+            m_next = head;
+        } while (!m_sites.compare_exchange_weak(head, this, boost::memory_order_release, boost::memory_order_relaxed));
+    }
+
+    // ======================================================================================================
+    Logger* Logger::create_instance()
     {
+        // Only the first callers get here, the check is repeated under the lock so we create it once
         logger::logLock.lock();
-        if (m_instance == 0)
+        Logger* logger = m_instance.load(boost::memory_order_relaxed);
+        if (logger == 0)
         {
+            // A level set before the logger exists wins over the environment
+            std::int32_t level = parse_log_level(chaos::get_environment_string("LOG_LEVEL"));
+            if (level >= 0 && !m_log_level_set.load(boost::memory_order_relaxed))
+                m_log_level.store(level, boost::memory_order_relaxed);
+
             // Lets create it
-            m_instance = new Logger();
+            logger = new Logger();
+            m_instance.store(logger, boost::memory_order_release);
         }
         logger::logLock.unlock();
 
-        return m_instance;
+        return logger;
+    }
+
+    // ======================================================================================================
+    void Logger::shutdown()
+    {
+        logger::logLock.lock();
+        Logger* logger = m_instance.exchange(0, boost::memory_order_acq_rel);
+        logger::logLock.unlock();
+
+        if (logger)
+        {
+            // Whatever was logged since the last pass is written on the strand before it stops,
+            // once stopped write_log_message() drops everything
+            logger->flush();
+            logger->stop();
+            logger->join();
+            delete logger;
+        }
     }
 
     // ======================================================================================================
@@ -83,11 +175,17 @@ namespace chaos
         m_thread(NULL),
         m_timer(m_log_io, boost::posix_time::seconds(1)),
         m_strand(m_log_io),
+        m_log_stream(&m_log_buffer),
+        m_crash_fd(-1),
+        m_in_flight(0),
         m_application_name(chaos::ApplicationDetails::instance()->get_application_name()),
-        m_mother(NULL),
-        m_heartbeat_counter(0),
-        m_shutdown(false)
+        m_publisher(NULL),
+        m_control(NULL),
+        m_shutdown(false),
+        m_dispatcher(this)
     {
+        m_dispatcher.register_handler<LogMessage, &Logger::write_log_message>();
+
         std::string dir = chaos::get_environment_string("LOG_DIRECTORY");
         if (dir.empty())
             dir = "logs";
@@ -96,14 +194,18 @@ namespace chaos
         if (!temp.empty())
             m_application_name = temp;
 
+        std::uint32_t limit = chaos::get_environment_int("CHAOS_LOG_SITE_LIMIT");
+        if (limit != 0)
+            LogSite::set_limit(limit);
+
         // First lets create the log file
         std::string file = dir + "/" + m_application_name + "_" + chaos::time_as_string("%Y%m%d_%H%M%S") + ".log";
         struct stat st;
         if (stat(dir.c_str(), &st) == 0)
         {
             // The directory exist so create the file and open it to write
-            m_log_stream.open(file.c_str(), std::ios_base::out);
-            if (!m_log_stream.is_open())
+            m_log_buffer.open(file.c_str(), std::ios_base::out);
+            if (!m_log_buffer.is_open())
             {
                 std::cerr << "Failed to create log file ... " << file << std::endl;
             }
@@ -123,8 +225,8 @@ namespace chaos
             if (_mkdir(dir.c_str()) == 0)
 #endif
             {
-                m_log_stream.open(file.c_str(), std::ios_base::out);
-                if (!m_log_stream.is_open())
+                m_log_buffer.open(file.c_str(), std::ios_base::out);
+                if (!m_log_buffer.is_open())
                 {
                     std::cerr << "Failed to create log file ... " << file << std::endl;
                 }
@@ -141,35 +243,33 @@ namespace chaos
             }
         }
 
-        m_thread = new boost::thread(&Logger::log_io_thread, this);
-        m_timer.async_wait(m_strand.wrap(boost::bind(&Logger::write_to_file, this)));
+#ifndef WIN32
+        // A second descriptor on the same file for the crash handler, it can't use the stream
+        if (m_log_buffer.is_open())
+            m_crash_fd = open(file.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (chaos::get_environment_string("CHAOS_NO_CRASH_HANDLER").empty())
+            install_crash_handler();
+#endif
+
+        // Mother is published to from its own thread so a slow network never holds up the file
+        m_publisher = new chaos::MotherPublisher(m_application_name);
 
+        // Mother can only reach every application with a CONTROL message over multicast, a
+        // unicast mother address is mother's own socket and isn't ours to bind
         auto app_desc = chaos::ApplicationDetails::instance();
-        // We will only be publishing messages from this object
-        m_mother = new chaos::Udp(m_log_io, app_desc->get_mothers_address(), app_desc->get_mothers_port(), false, false);
-
-        // The message object for the mother heartbeat
-        m_mother_msg.clear();
-        m_mother_msg.header.m_type = chaos::MessageTypes::MOTHER;
-        m_mother_msg.header.m_length = m_mother_msg.mother.getLength();
-        strcpy(m_mother_msg.mother.m_application, m_application_name.c_str());
-        strcpy(m_mother_msg.mother.m_description, app_desc->get_application_description().c_str());
-        strcpy(m_mother_msg.mother.m_location, app_desc->get_application_location().c_str());
-        strcpy(m_mother_msg.mother.m_instance, app_desc->get_application_name().c_str());
-        strcpy(m_mother_msg.mother.m_host, boost::asio::ip::host_name().c_str());
-        strcpy(m_mother_msg.mother.m_start_time, app_desc->get_application_start_time().c_str());
-        strcpy(m_mother_msg.mother.m_version, app_desc->get_application_version().c_str());
-        m_mother_msg.mother.m_pid = chaos::get_pid();
-        m_mother_msg.mother.m_tcp_pid = app_desc->get_application_tcp_port();
-        m_mother_msg.mother.m_udp_port = app_desc->get_application_tcp_port();
-
-        // The message object for the event log
-        m_log_msg.clear();
-        m_log_msg.header.m_type = chaos::MessageTypes::LOG;
-        m_log_msg.header.m_length = m_mother_msg.log.getLength();
-        strcpy(m_log_msg.log.m_application, m_application_name.c_str());
-        strcpy(m_log_msg.log.m_instance, app_desc->get_application_name().c_str());
-        strcpy(m_log_msg.log.m_host, boost::asio::ip::host_name().c_str());
+        try
+        {
+            if (boost::asio::ip::address::from_string(app_desc->get_mothers_address()).is_multicast())
+                m_control = new chaos::LogControl(m_log_io, app_desc->get_mothers_address(), app_desc->get_mothers_port(),
+                                                  m_application_name, app_desc->get_application_name());
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << "Failed to listen for control messages ... " << e.what() << std::endl;
+        }
+
+        m_thread = new boost::thread(&Logger::log_io_thread, this);
+        m_timer.async_wait(m_strand.wrap(boost::bind(&Logger::write_to_file, this)));
     }
 
     // ======================================================================================================
@@ -196,78 +296,338 @@ namespace chaos
             m_thread = NULL;
         }
 
-        if (m_log_stream.is_open())
-            m_log_stream.close();
+        if (m_control)
+        {
+            delete m_control;
+            m_control = NULL;
+        }
+
+        // Sends anything still queued for mother
+        if (m_publisher)
+        {
+            delete m_publisher;
+            m_publisher = NULL;
+        }
+
+        if (m_log_buffer.is_open())
+            m_log_buffer.close();
+
+#ifndef WIN32
+        if (m_crash_fd >= 0)
+            close(m_crash_fd);
+#endif
     }
 
     // ======================================================================================================
-    void Logger::log_information(std::int32_t state, const std::string& msg, const std::string& file, std::int32_t line)
+    void Logger::write_to_file()
     {
-        LogMessage* data = new LogMessage(state, msg, file, line);
-        m_queue.push(data);
+        drain();
+
+        // A new rate limit window for every LOG statement, and a line for those that dropped messages
+        LogSite::advance_epoch();
+        if (report_suppressed())
+        {
+            m_log_stream.flush();
+            if (m_publisher)
+                m_publisher->notify();
+        }
+
+        if (m_log_buffer.is_open() && are_we_running_in_normal_mode())
+        {
+            // Now lets sleep for a second before processing these messages again
+            m_timer.expires_at(m_timer.expires_at() + boost::posix_time::seconds(1));
+            m_timer.async_wait(m_strand.wrap(boost::bind(&Logger::write_to_file, this)));
+        }
+        else
+        {
+            std::cerr << "PUBLIC - logging thread is shutting down" << std::endl;
+        }
     }
 
     // ======================================================================================================
-    void Logger::write_to_file()
+    void Logger::drain()
     {
         chaos::WaitFreeQueue<chaos::IQueue*>::node* x = m_queue.pop_all();
         while (x)
         {
             chaos::WaitFreeQueue<chaos::IQueue*>::node* tmp = x;
+            x = x->next;
 
-            switch (tmp->data->get_type())
-            {
-                case chaos::QT_Logger:
-                {
-                    // This is a normal log message
-                    LogMessage* lm = dynamic_cast<LogMessage*>(tmp->data);
-                    if (lm)
-                    {
-                        if (m_log_stream.is_open() && are_we_running_in_normal_mode())
-                        {
-                            try
-                            {
-                                std::stringstream ss;
-                                ss << chaos::time_in_micros(lm->m_now) << " [" << get_state(lm->m_state) << "][" << lm->m_id << "] " << lm->m_msg << "  [" << lm->m_file << ":" << lm->m_line << "]\n";
-                                m_log_stream << ss.str();
-
-                                // Lets publish the FATAL, ERROR and PUBLIC messages to Mother
-                                if (lm->m_state <= PUB_MSG)
-                                    publish_log_message(lm->m_state, lm->m_msg);
-                            }
-                            catch (...)
-                            {
-                                // When we are shutting down we could be in this conditional statement but we want to exit out of it
-                                break;
-                            }
-                        }
-                    }
-                }
-                break;
+            // What the crash handler still has to write if we die part way through the list
+            m_in_flight.store(x, boost::memory_order_release);
+
+            // Routes to the registered handler and deletes the message
+            m_dispatcher.dispatch(tmp->data);
+            delete tmp;
+        }
+
+        // Send the freed messages back to the threads that logged them
+        LogMessage::flush_pool();
+        chaos::WaitFreeQueue<chaos::IQueue*>::node::flush_pool();
+
+        // One wake up for everything this pass queued for mother
+        if (m_publisher)
+            m_publisher->notify();
+
+        if (m_log_buffer.is_open())
+            m_log_stream.flush();
+    }
+
+    // ======================================================================================================
+    void Logger::flush()
+    {
+        if (!are_we_running_in_normal_mode())
+            return;
+
+        // The logger thread itself can just do it
+        if (m_thread && boost::this_thread::get_id() == m_thread->get_id())
+        {
+            drain();
+            return;
+        }
+
+        // Runs on the strand so it never overlaps with write_to_file. The promise is shared with
+        // the handler so it outlives us if we give up waiting.
+        boost::shared_ptr< boost::promise<void> > done = boost::make_shared< boost::promise<void> >();
+        auto future = done->get_future();
+        m_strand.post([this, done]()
+        {
+            drain();
+            done->set_value();
+        });
 
+        // If the io_service stopped (shutdown or the logger thread has gone) the handler will
+        // never run, so we wait in short steps and give up once it has
+        while (!future.timed_wait(boost::posix_time::milliseconds(100)))
+        {
+            if (m_log_io.stopped())
+                return;
+        }
+    }
+
+#ifndef WIN32
+    // ======================================================================================================
+    // Everything the crash handler touches is static or pre-allocated, it only calls write(2),
+    // fsync(2), sigaction(2) and raise(3)
+    namespace logger
+    {
+        static const int            CRASH_SIGNALS[] = { SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL };
+        static const std::size_t    CRASH_SIGNAL_COUNT = sizeof(CRASH_SIGNALS) / sizeof(CRASH_SIGNALS[0]);
+        static const std::size_t    MAX_CRASH_MESSAGES = 4096;
+
+        static struct sigaction     previous_actions[CRASH_SIGNAL_COUNT];
+        static boost::atomic<bool>  crash_handler_installed(false);
+        static boost::atomic<bool>  crashing(false);
+        static char                 alt_stack[64 * 1024];
+        static chaos::IQueue*       crash_messages[MAX_CRASH_MESSAGES];
+
+        // ==================================================================================================
+        static void write_all(int fd, const char* p, std::size_t n)
+        {
+            while (n > 0)
+            {
+                ssize_t written = write(fd, p, n);
+                if (written < 0 && errno == EINTR)
+                    continue;
+                if (written <= 0)
+                    return;
+                p += written;
+                n -= static_cast<std::size_t>(written);
             }
+        }
 
-            x = x->next;
-            // Clean-up time
-            delete tmp->data;
-            delete tmp;
+        // ==================================================================================================
+        static void write_text(int fd, const char* text)
+        {
+            write_all(fd, text, strlen(text));
         }
 
-        if (m_log_stream.is_open() && are_we_running_in_normal_mode())
+        // ==================================================================================================
+        static void write_number(int fd, std::uint64_t value, int width = 0)
         {
-            m_log_stream.flush();
+            char buffer[24];
+            char* p = buffer + sizeof(buffer);
+            do
+            {
+                *--p = static_cast<char>('0' + value % 10);
+                value /= 10;
+                --width;
+            } while (value != 0 || width > 0);
+            write_all(fd, p, static_cast<std::size_t>(buffer + sizeof(buffer) - p));
+        }
 
-            // Lets send the mother heartbeat every 5 seconds
-            publish_mothers_heartbeat();
+        // ==================================================================================================
+        static void write_crash_message(int fd, chaos::IQueue* msg)
+        {
+            if (!msg || msg->get_type() != LogMessage::QUEUE_TYPE)
+                return;
+
+            // Same layout as write_log_message() with CRASH in place of the thread id
+            LogMessage* lm = static_cast<LogMessage*>(msg);
+            boost::posix_time::time_duration now = lm->m_now.time_of_day();
+            write_number(fd, now.hours(), 2);
+            write_text(fd, ":");
+            write_number(fd, now.minutes(), 2);
+            write_text(fd, ":");
+            write_number(fd, now.seconds(), 2);
+            write_text(fd, ".");
+            write_number(fd, now.fractional_seconds(), 6);
+            write_text(fd, " [");
+            write_text(fd, get_state(lm->m_state));
+            write_text(fd, "][CRASH] ");
+            write_all(fd, lm->m_msg.data(), lm->m_msg.size());
+            write_text(fd, "  [");
+            write_text(fd, lm->m_file);
+            write_text(fd, ":");
+            write_number(fd, static_cast<std::uint64_t>(lm->m_line));
+            write_text(fd, "]\n");
+        }
+    }
 
-            // Now lets sleep for a second before processing these messages again
-            m_timer.expires_at(m_timer.expires_at() + boost::posix_time::seconds(1));
-            m_timer.async_wait(m_strand.wrap(boost::bind(&Logger::write_to_file, this)));
+    // ======================================================================================================
+    void Logger::install_crash_handler()
+    {
+        if (logger::crash_handler_installed.exchange(true))
+            return;
+
+        // A stack overflow leaves no stack to run the handler on, give the installing thread a spare
+        stack_t ss;
+        ss.ss_sp = logger::alt_stack;
+        ss.ss_size = sizeof(logger::alt_stack);
+        ss.ss_flags = 0;
+        sigaltstack(&ss, NULL);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = &Logger::on_crash;
+        action.sa_flags = SA_ONSTACK;
+
+        // A second fault while we drain is blocked, which makes the kernel kill us outright
+        sigemptyset(&action.sa_mask);
+        for (std::size_t i = 0; i < logger::CRASH_SIGNAL_COUNT; ++i)
+            sigaddset(&action.sa_mask, logger::CRASH_SIGNALS[i]);
+
+        for (std::size_t i = 0; i < logger::CRASH_SIGNAL_COUNT; ++i)
+            sigaction(logger::CRASH_SIGNALS[i], &action, &logger::previous_actions[i]);
+    }
+
+    // ======================================================================================================
+    void Logger::on_crash(int sig)
+    {
+        if (logger::crashing.exchange(true))
+        {
+            // Another thread is already draining and will take the process down when it's done
+            for (;;)
+                pause();
         }
-        else
+
+        Logger* logger = m_instance.load(boost::memory_order_acquire);
+        if (logger)
+            logger->emergency_drain(sig);
+
+        // Hand the signal to whoever had it before us, it is delivered once we return
+        for (std::size_t i = 0; i < logger::CRASH_SIGNAL_COUNT; ++i)
         {
-            std::cerr << "PUBLIC - logging thread is shutting down" << std::endl;
+            if (logger::CRASH_SIGNALS[i] == sig)
+                sigaction(sig, &logger::previous_actions[i], NULL);
+        }
+        raise(sig);
+    }
+
+    // ======================================================================================================
+    void Logger::emergency_drain(int sig)
+    {
+        // The logger thread may still be running, this is best effort and reads what it can
+        int fd = (m_crash_fd >= 0) ? m_crash_fd : STDERR_FILENO;
+
+        // Formatted by the logger thread but still in the stream buffer
+        if (m_log_buffer.is_open())
+        {
+            const char* begin = m_log_buffer.pending_begin();
+            const char* end = m_log_buffer.pending_end();
+            if (begin && end > begin)
+                logger::write_all(fd, begin, static_cast<std::size_t>(end - begin));
+        }
+
+        logger::write_text(fd, "*** caught signal ");
+        logger::write_number(fd, static_cast<std::uint64_t>(sig));
+        logger::write_text(fd, ", writing the messages not yet logged ***\n");
+
+        // Taken off the queue by the logger thread but not written yet, these are oldest first
+        for (chaos::WaitFreeQueue<chaos::IQueue*>::node* n = m_in_flight.load(boost::memory_order_acquire); n; n = n->next)
+            logger::write_crash_message(fd, n->data);
+
+        // Still on the queue, newest first, so collect them and write them in reverse
+        std::size_t count = 0;
+        std::uint64_t skipped = 0;
+        for (chaos::WaitFreeQueue<chaos::IQueue*>::node* n = m_queue.peek(); n; n = n->next)
+        {
+            if (count < logger::MAX_CRASH_MESSAGES)
+                logger::crash_messages[count++] = n->data;
+            else
+                ++skipped;
+        }
+
+        if (skipped)
+        {
+            logger::write_text(fd, "*** ");
+            logger::write_number(fd, skipped);
+            logger::write_text(fd, " older messages were lost ***\n");
+        }
+
+        while (count > 0)
+            logger::write_crash_message(fd, logger::crash_messages[--count]);
+
+        logger::write_text(fd, "*** end of crash log ***\n");
+        fsync(fd);
+    }
+#else
+    // ======================================================================================================
+    void Logger::install_crash_handler()
+    {
+    }
+#endif
+
+    // ======================================================================================================
+    void Logger::write_log_message(LogMessage& lm)
+    {
+        // This is a normal log message
+        if (m_log_buffer.is_open() && are_we_running_in_normal_mode())
+        {
+            try
+            {
+                std::stringstream ss;
+                ss << chaos::time_in_micros(lm.m_now) << " [" << get_state(lm.m_state) << "][" << lm.m_id << "] " << lm.m_msg << "  [" << lm.m_file << ":" << lm.m_line << "]\n";
+                m_log_stream << ss.str();
+
+                // Lets publish the FATAL, ERROR and PUBLIC messages to Mother
+                if (lm.m_state <= PUB_MSG)
+                    publish_log_message(lm.m_state, lm.m_msg);
+            }
+            catch (...)
+            {
+                // When we are shutting down we could be in this conditional statement but we want to exit out of it
+            }
+        }
+    }
+
+    // ======================================================================================================
+    bool Logger::report_suppressed()
+    {
+        bool reported = false;
+        for (LogSite* site = LogSite::get_sites(); site != 0; site = site->get_next())
+        {
+            std::uint32_t suppressed = site->take_suppressed();
+            if (suppressed == 0)
+                continue;
+
+            std::stringstream ss;
+            ss << "suppressed " << suppressed << " messages, the limit is " << LogSite::get_limit() << " a second";
+            LogMessage lm(site->m_state.load(boost::memory_order_relaxed), ss.str(), site->m_file, site->m_line);
+            write_log_message(lm);
+            reported = true;
         }
+        return reported;
     }
 
     // ======================================================================================================
@@ -291,32 +651,9 @@ namespace chaos
     // ======================================================================================================
     void Logger::publish_log_message(int state, const std::string& msg)
     {
-        if (m_mother)
-        {
-            m_log_msg.log.clear_log_message();
-
-            strcpy(m_log_msg.log.m_severity, get_state(state));
-            // 1024 is the maximum length we can send
-            if (msg.size() <= 1023)
-                strcpy(m_log_msg.log.m_log_message, msg.c_str());
-            else
-                strncpy(m_log_msg.log.m_log_message, msg.c_str(), 1023);
-
-            m_mother->send_msg(m_log_msg);
-        }
-    }
-    
-    // ======================================================================================================
-    void Logger::publish_mothers_heartbeat()
-    {
-        // Send the ping every 5 seconds
-        if (m_mother && (++m_heartbeat_counter % 5 == 0))
-        {
-            // The version can update while the application is running so we need to update this as well
-            memset(m_mother_msg.mother.m_version, 0, sizeof(m_mother_msg.mother.m_version));
-            strcpy(m_mother_msg.mother.m_version, chaos::ApplicationDetails::instance()->get_application_version().c_str());
-            m_mother->send_msg(m_mother_msg);
-        }
+        // Only queues the message, the publisher thread does the sending
+        if (m_publisher)
+            m_publisher->publish(state, msg);
     }
 
     // ======================================================================================================
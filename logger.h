@@ -6,12 +6,16 @@
 
 #include "utils.h"
 #include "queue_types.h"
+#include "object_pool.h"
 #include "wait_free_queue.h"
 #include "time_utils.h"
 #include "udp_messages.h"
 #include "udp.h"
+#include "mother_publisher.h"
 
+#include <fstream>
 #include <map>
+#include <ostream>
 
 #include <boost/asio.hpp>
 #include <boost/asio/io_service.hpp>
@@ -32,7 +36,19 @@
 #define WARN_MSG	    4
 #define DEB_MSG         5
 
-#define LOG( X, Y )     chaos::Logger::instance()->log_information( X, Y, __FILE__, __LINE__ );
+// A message above the log level costs one relaxed load. Past that every LOG statement owns a
+// LogSite, a message over the site's per second limit is counted and dropped. Either way the
+// message text is never built. The level is checked again after instance() because the first
+// call is the one that reads LOG_LEVEL.
+#define LOG( X, Y )     do { \
+                            if ((X) <= chaos::Logger::get_log_level()) \
+                            { \
+                                chaos::Logger* chaos_logger = chaos::Logger::instance(); \
+                                static chaos::LogSite chaos_log_site(__FILE__, __LINE__); \
+                                if ((X) <= chaos::Logger::get_log_level() && chaos_log_site.allow(X)) \
+                                    chaos_logger->log_information( X, Y, __FILE__, __LINE__ ); \
+                            } \
+                        } while (0);
 #define SPACE           std::string(" ")
 #define STR( X )        std::string(X)
 
@@ -40,9 +56,93 @@
 namespace chaos
 {
     // ===============================================================================================
-    class LogMessage : public chaos::IQueue
+    // The three letter severity written to the log file and sent to mother
+    const char* get_state(int state);
+
+    class LogControl;
+
+    // ===============================================================================================
+    // Rate limit for a single LOG statement. The window is a one second epoch advanced by the
+    // logger thread, each site lets through at most get_limit() messages per epoch and counts
+    // the rest. The counters are relaxed atomics, two threads racing over the epoch change can
+    // let a message or two more through, which is fine. The logger thread walks every site once
+    // a second and writes a "suppressed N messages" line for the sites that dropped anything.
+    //
+    // Deduplication is by call site, the text isn't compared because building it is the cost we
+    // are avoiding. Identical text is coalesced again on the way to mother.
+    //
+    // The limit comes from CHAOS_LOG_SITE_LIMIT, the default is 100 messages a second and 0 in
+    // the environment keeps the default.
+    class LogSite
+    {
+    public:
+        LogSite(const char* file, std::int32_t line);
+
+        inline bool allow(std::int32_t state)
+        {
+            std::uint32_t epoch = m_current_epoch.load(boost::memory_order_relaxed);
+            if (m_epoch.load(boost::memory_order_relaxed) != epoch)
+            {
+                m_epoch.store(epoch, boost::memory_order_relaxed);
+                m_count.store(0, boost::memory_order_relaxed);
+            }
+
+            if (m_count.fetch_add(1, boost::memory_order_relaxed) < m_limit.load(boost::memory_order_relaxed))
+                return true;
+
+            m_state.store(state, boost::memory_order_relaxed);
+            m_suppressed.fetch_add(1, boost::memory_order_relaxed);
+            return false;
+        }
+
+        // Called by the logger thread once a second
+        static void advance_epoch() { m_current_epoch.fetch_add(1, boost::memory_order_relaxed); }
+        static LogSite* get_sites() { return m_sites.load(boost::memory_order_acquire); }
+        static std::uint32_t get_limit() { return m_limit.load(boost::memory_order_relaxed); }
+        static void set_limit(std::uint32_t limit) { m_limit.store(limit, boost::memory_order_relaxed); }
+
+        std::uint32_t take_suppressed() { return m_suppressed.exchange(0, boost::memory_order_relaxed); }
+        LogSite* get_next() { return m_next; }
+
+        const char*                     m_file;
+        std::int32_t                    m_line;
+        boost::atomic<std::int32_t>     m_state;
+
+    private:
+        boost::atomic<std::uint32_t>    m_epoch;
+        boost::atomic<std::uint32_t>    m_count;
+        boost::atomic<std::uint32_t>    m_suppressed;
+        LogSite*                        m_next;
+
+        static boost::atomic<std::uint32_t>     m_current_epoch;
+        static boost::atomic<std::uint32_t>     m_limit;
+        static boost::atomic<LogSite*>          m_sites;
+
+    };
+
+    // ===============================================================================================
+    // The log file buffer, a fixed block inside the logger rather than one the library allocates,
+    // with the part that hasn't been written to the file exposed for the crash handler
+    class LogFileBuffer : public std::filebuf
+    {
+    public:
+        LogFileBuffer() { pubsetbuf(m_storage, sizeof(m_storage)); }
+
+        const char* pending_begin() { return pbase(); }
+        const char* pending_end() { return pptr(); }
+
+    private:
+        char    m_storage[64 * 1024];
+
+    };
+
+    // ===============================================================================================
+    // Allocated by the logging thread and deleted by the logger thread, so it uses the pool
+    class LogMessage final : public chaos::IQueue, public chaos::Pooled<LogMessage>
     {
     public:
+        static const chaos::QueueType QUEUE_TYPE = chaos::QT_Logger;
+
         LogMessage() :
             m_state(0),
             m_msg(""),
@@ -51,10 +151,10 @@ namespace chaos
             m_id(boost::this_thread::get_id()),
             m_now(boost::posix_time::microsec_clock::universal_time())
         {
-            set_type(chaos::QT_Logger);
+            set_type(QUEUE_TYPE);
         }
 
-        LogMessage(std::int32_t s, const std::string& m, const std::string& f, std::int32_t l) :
+        LogMessage(std::int32_t s, const std::string& m, const char* f, std::int32_t l) :
             m_state(s),
             m_msg(m),
             m_file(f),
@@ -62,12 +162,14 @@ namespace chaos
             m_id(boost::this_thread::get_id()),
             m_now(boost::posix_time::microsec_clock::universal_time())
         {
-            set_type(chaos::QT_Logger);
+            set_type(QUEUE_TYPE);
         }
 
+        virtual IQueue* clone() { return new LogMessage(*this); }
+
         std::int32_t    m_state;
         std::string     m_msg;
-        std::string     m_file;
+        const char*     m_file;         // __FILE__, so it lives as long as the program
         std::int32_t    m_line;
 
         boost::thread::id           m_id;
@@ -76,6 +178,16 @@ namespace chaos
     };
 
     // =============================================================================
+    // The logger is a singleton, the lookup on the hot path is a single acquire load and only
+    // the first call takes the lock to create it. Start-up and shut-down are explicit and
+    // ordered, ApplicationDetails first and then the Logger, torn down in the reverse order:
+    //
+    //      chaos::ApplicationDetails::instance()->set_details(...);
+    //      chaos::Logger::instance();
+    //      ...
+    //      chaos::Logger::shutdown();
+    //      chaos::ApplicationDetails::shutdown();
+    //
     class Logger
     {
     protected:
@@ -83,10 +195,49 @@ namespace chaos
 
     public:
         virtual ~Logger();
-        static Logger* instance();
+
+        static Logger* instance()
+        {
+            Logger* logger = m_instance.load(boost::memory_order_acquire);
+            return (logger != 0) ? logger : create_instance();
+        }
+
+        // Stops the logging thread and destroys the instance. Every thread that logs must have
+        // finished before this is called.
+        static void shutdown();
+
+        // Blocks until everything logged before the call is written to the file and handed to the
+        // mother publisher. Returns without waiting if the logger's io_service has stopped and
+        // can't be used after shutdown().
+        void flush();
+
+        // On SIGSEGV, SIGABRT, SIGBUS, SIGFPE and SIGILL the handler writes the unflushed part of
+        // the file buffer, the messages being written and the messages still queued straight to
+        // the log file with write(2), then hands the signal on to the handler that was there
+        // before. Installed by the constructor unless CHAOS_NO_CRASH_HANDLER is set.
+        static void install_crash_handler();
+
+        // Messages with a state above the level are dropped by the LOG macro. The level is taken
+        // from LOG_LEVEL in the environment when the logger is created, a number or a name (FAT,
+        // ERR, PUB, INF, WARN, DEB), everything is logged if it isn't set. Mother can change it
+        // with a CONTROL message.
+        static std::int32_t get_log_level() { return m_log_level.load(boost::memory_order_relaxed); }
+        static void set_log_level(std::int32_t level)
+        {
+            m_log_level.store(level, boost::memory_order_relaxed);
+            m_log_level_set.store(true, boost::memory_order_relaxed);
+        }
+        static std::int32_t parse_log_level(const std::string& level);
 
         void join() { m_thread->join(); }
-        void log_information(std::int32_t state, const std::string& msg, const std::string& file, std::int32_t line);
+
+        // Inline so the LOG macro costs the allocation and one CAS at the call site, everything
+        // else happens on the logging thread
+        void log_information(std::int32_t state, const std::string& msg, const char* file, std::int32_t line)
+        {
+            m_queue.push(new LogMessage(state, msg, file, line));
+        }
+
         void stop() 
         { 
             m_shutdown = true;
@@ -95,27 +246,37 @@ namespace chaos
 
     private:
         void write_to_file();
+        void drain();
+        void emergency_drain(int sig);
+        static void on_crash(int sig);
+        void write_log_message(LogMessage& lm);
+        bool report_suppressed();
         void log_io_thread();
         void create_if_doesnt_exist(const std::string& dir);
         void publish_log_message(int state, const std::string& msg);
-        void publish_mothers_heartbeat();
         bool are_we_running_in_normal_mode() { return !m_shutdown;  }
 
     private:
-        static Logger*                          m_instance;
+        static Logger* create_instance();
+
+    private:
+        static boost::atomic<Logger*>           m_instance;
+        static boost::atomic<std::int32_t>      m_log_level;
+        static boost::atomic<bool>              m_log_level_set;
         chaos::WaitFreeQueue<chaos::IQueue*>    m_queue;
         boost::thread*                          m_thread;
         boost::asio::io_service                 m_log_io;
         boost::asio::deadline_timer             m_timer;
         boost::asio::io_service::strand         m_strand;
-        std::uint32_t                           m_log_level;
-        std::ofstream                           m_log_stream;
+        chaos::LogFileBuffer                    m_log_buffer;
+        std::ostream                            m_log_stream;
+        int                                     m_crash_fd;
+        boost::atomic<chaos::WaitFreeQueue<chaos::IQueue*>::node*>  m_in_flight;
         std::string                             m_application_name;
-        chaos::UDP_MSG                          m_mother_msg;
-        chaos::UDP_MSG                          m_log_msg;
-        chaos::Udp*                             m_mother;
-        std::int32_t                            m_heartbeat_counter;
+        chaos::MotherPublisher*                 m_publisher;
+        chaos::LogControl*                      m_control;
         volatile bool                           m_shutdown;
+        chaos::QueueDispatcher<Logger>          m_dispatcher;
 
     };
 } // End of namespace
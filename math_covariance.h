@@ -0,0 +1,319 @@
+// Rolling covariance and correlation matrix across many aligned series
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include "math_statistics.h"
+#include "spin_lock.h"
+#include "thread_pool.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <boost/atomic.hpp>
+
+// =================================================================================================
+namespace chaos
+{
+    namespace math
+    {
+        namespace statistics
+        {
+            // =====================================================================================
+            // Population covariance (same definition as stdev_p) of the last w ticks across N
+            // aligned series. Every tick provides one value per series and the cross sums are
+            // updated in place, so a tick costs O(N^2) no matter how long the window is.
+            //
+            // The cross sums are the upper triangle of a row major matrix whose rows are padded to
+            // a multiple of 8 doubles, the inner loop of a row is a contiguous multiply-add the
+            // compiler vectorizes. Rows are independent so a tick can be split across threads,
+            // either with add(x, pool) or by calling begin_update() once and then update_rows()
+            // for disjoint row ranges from your own workers.
+            class RollingCovariance
+            {
+            public:
+                RollingCovariance(std::size_t series, std::int32_t w = 500) :
+                    m_series(series),
+                    m_stride((series + 7) & ~static_cast<std::size_t>(7)),
+                    m_window(w > 0 ? w : 1),
+                    m_pos(0),
+                    m_ticks(0),
+                    m_n(0),
+                    m_prev_n(0),
+                    m_recentre(false),
+                    m_values(series * m_window, 0.0),
+                    m_ref(series, 0.0),
+                    m_sum(series, 0.0),
+                    m_prev_sum(series, 0.0),
+                    m_delta(series, 0.0),
+                    m_new(series, 0.0),
+                    m_old(series, 0.0),
+                    m_cross(series * m_stride, 0.0),
+                    m_blocks_left(0) {}
+
+                std::size_t get_series_count() { return m_series; }
+                bool is_buffer_full() { return (m_n >= m_window ? true : false); }
+                double get_percent_buffered() { return (m_n / static_cast<double>(m_window)); }
+
+                bool get_average(std::size_t i, double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        v = m_ref[i] + m_sum[i] / m_n;
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool get_stdev(std::size_t i, double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        v = std::sqrt(variance(i));
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool get_covariance(std::size_t i, std::size_t j, double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        v = covariance(i, j);
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool get_correlation(std::size_t i, std::size_t j, double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        v = correlation(i, j);
+                        return true;
+                    }
+                    return false;
+                }
+
+                // Full N x N row major matrices
+                bool get_covariance_matrix(std::vector<double>& m)
+                {
+                    if(!is_buffer_full())
+                        return false;
+
+                    m.resize(m_series * m_series);
+                    for(std::size_t i=0; i<m_series; ++i)
+                    {
+                        for(std::size_t j=i; j<m_series; ++j)
+                            m[i * m_series + j] = m[j * m_series + i] = covariance(i, j);
+                    }
+                    return true;
+                }
+
+                bool get_correlation_matrix(std::vector<double>& m)
+                {
+                    if(!is_buffer_full())
+                        return false;
+
+                    m.resize(m_series * m_series);
+                    for(std::size_t i=0; i<m_series; ++i)
+                    {
+                        for(std::size_t j=i; j<m_series; ++j)
+                            m[i * m_series + j] = m[j * m_series + i] = correlation(i, j);
+                    }
+                    return true;
+                }
+
+                // x must hold one value per series
+                void add(const double* x)
+                {
+                    begin_update(x);
+                    update_rows(0, m_series);
+                }
+
+                void add(const std::vector<double>& x)
+                {
+                    add(x.data());
+                }
+
+                // Splits the rows across the pool workers and the caller, then spins until its own
+                // blocks are done so other work in the pool doesn't hold it up. Called from one of
+                // the workers it needs another worker free to take the blocks.
+                void add(const double* x, chaos::ThreadPool& pool)
+                {
+                    begin_update(x);
+                    if(pool.get_thread_count() == 0)
+                    {
+                        update_rows(0, m_series);
+                        return;
+                    }
+
+                    // The partition only changes with the pool size and the task list keeps its
+                    // capacity, so a tick allocates nothing once they are set up
+                    if(m_bounds.size() != pool.get_thread_count() + 2)
+                        get_row_partition(pool.get_thread_count() + 1, m_bounds);
+
+                    // The caller takes the last block while the workers run the rest
+                    std::size_t blocks = m_bounds.size() - 2;
+                    m_blocks_left.store(blocks, boost::memory_order_relaxed);
+                    for(std::size_t t=0; t<blocks; ++t)
+                        m_tasks.push_back(RowBlock(this, t));
+                    pool.submit_batch(m_tasks);
+                    update_rows(m_bounds[blocks], m_bounds[blocks+1]);
+
+                    while(m_blocks_left.load(boost::memory_order_acquire) != 0)
+                        chaos::cpu_relax();
+                }
+
+                // Stores the tick and updates the per series sums, this is O(N) and must be called
+                // once per tick before any update_rows()
+                void begin_update(const double* x)
+                {
+                    std::size_t row = static_cast<std::size_t>(m_pos) * m_series;
+                    bool full = is_buffer_full();
+
+                    if(m_ticks == 0)
+                    {
+                        for(std::size_t i=0; i<m_series; ++i)
+                            m_ref[i] = x[i];
+                    }
+
+                    // Once per window we move the references to the current means so the shifted
+                    // values stay small. The cross sums are moved by the same amount in
+                    // update_rows() which keeps the result exact.
+                    m_recentre = (m_ticks > 0 && (m_ticks % m_window) == 0);
+                    m_prev_n = m_n;
+                    for(std::size_t i=0; i<m_series; ++i)
+                    {
+                        m_prev_sum[i] = m_sum[i];
+                        m_delta[i] = m_recentre ? (m_sum[i] / m_n) : 0.0;
+                        m_ref[i] += m_delta[i];
+                        m_sum[i] -= m_n * m_delta[i];
+
+                        m_new[i] = x[i] - m_ref[i];
+                        m_old[i] = full ? (m_values[row + i] - m_ref[i]) : 0.0;
+                        m_sum[i] += m_new[i] - m_old[i];
+                        m_values[row + i] = x[i];
+                    }
+
+                    if(!full)
+                        m_n += 1.0;
+                    m_pos = (m_pos + 1 == m_window) ? 0 : m_pos + 1;
+                    ++m_ticks;
+                }
+
+                // Updates the cross sums for rows [begin, end), disjoint ranges can run in parallel
+                void update_rows(std::size_t begin, std::size_t end)
+                {
+                    const double* dn = m_new.data();
+                    const double* dold = m_old.data();
+                    for(std::size_t i=begin; i<end && i<m_series; ++i)
+                    {
+                        double* c = m_cross.data() + i * m_stride;
+                        double a = dn[i];
+                        double b = dold[i];
+                        if(m_recentre)
+                        {
+                            const double* s = m_prev_sum.data();
+                            const double* d = m_delta.data();
+                            double di = d[i], si = s[i], n = m_prev_n;
+                            for(std::size_t j=i; j<m_series; ++j)
+                                c[j] += a * dn[j] - b * dold[j] - di * s[j] - d[j] * si + n * di * d[j];
+                        }
+                        else
+                        {
+                            for(std::size_t j=i; j<m_series; ++j)
+                                c[j] += a * dn[j] - b * dold[j];
+                        }
+                    }
+                }
+
+                // Splits the rows into blocks of roughly equal work, row i of the upper triangle
+                // costs N - i so the early blocks are narrower. bounds gets blocks + 1 entries.
+                void get_row_partition(std::size_t blocks, std::vector<std::size_t>& bounds)
+                {
+                    blocks = (blocks == 0) ? 1 : blocks;
+                    double total = 0.5 * static_cast<double>(m_series) * static_cast<double>(m_series + 1);
+                    double work = 0;
+                    bounds.clear();
+                    bounds.push_back(0);
+                    for(std::size_t i=0; i<m_series && bounds.size()<blocks; ++i)
+                    {
+                        work += static_cast<double>(m_series - i);
+                        if(work >= total * bounds.size() / blocks)
+                            bounds.push_back(i + 1);
+                    }
+                    while(bounds.size() <= blocks)
+                        bounds.push_back(m_series);
+                }
+
+            private:
+                // Small enough for boost::function to hold without allocating
+                struct RowBlock
+                {
+                    RollingCovariance*  m_owner;
+                    std::size_t         m_block;
+
+                    RowBlock(RollingCovariance* owner, std::size_t block) : m_owner(owner), m_block(block) {}
+
+                    void operator()() const
+                    {
+                        m_owner->update_rows(m_owner->m_bounds[m_block], m_owner->m_bounds[m_block+1]);
+                        m_owner->m_blocks_left.fetch_sub(1, boost::memory_order_release);
+                    }
+                };
+
+                double covariance(std::size_t i, std::size_t j)
+                {
+                    if(j < i)
+                        std::swap(i, j);
+                    double inv = 1.0 / m_n;
+                    return m_cross[i * m_stride + j] * inv - (m_sum[i] * inv) * (m_sum[j] * inv);
+                }
+
+                double variance(std::size_t i)
+                {
+                    double v = covariance(i, i);
+                    return (v > 0.0) ? v : 0.0;
+                }
+
+                double correlation(std::size_t i, std::size_t j)
+                {
+                    double d = variance(i) * variance(j);
+                    return (d > 0.0) ? (covariance(i, j) / std::sqrt(d)) : 0.0;
+                }
+
+                std::size_t         m_series;
+                std::size_t         m_stride;
+                std::int32_t        m_window;
+                std::int32_t        m_pos;
+                std::uint64_t       m_ticks;
+                double              m_n;
+                double              m_prev_n;
+                bool                m_recentre;
+
+                // Ring of the last w ticks, tick r holds [r * N, (r + 1) * N)
+                std::vector<double> m_values;
+
+                // Per series state
+                std::vector<double> m_ref;
+                std::vector<double> m_sum;
+                std::vector<double> m_prev_sum;
+                std::vector<double> m_delta;
+                std::vector<double> m_new;
+                std::vector<double> m_old;
+
+                // Upper triangle of the shifted cross sums, row i at i * m_stride
+                std::vector<double> m_cross;
+
+                // add(x, pool), kept from tick to tick
+                std::vector<std::size_t>                m_bounds;
+                std::vector<chaos::ThreadPool::Task>    m_tasks;
+                boost::atomic<std::size_t>              m_blocks_left;
+            };
+
+        }
+    }
+}
@@ -0,0 +1,239 @@
+// Streaming and rolling quantile estimators
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <set>
+#include <vector>
+
+// =================================================================================================
+namespace chaos
+{
+    namespace math
+    {
+        namespace statistics
+        {
+            // =====================================================================================
+            // Streaming estimate of a single quantile using the P-square algorithm from Jain and
+            // Chlamtac (1985). It keeps five markers so the memory is fixed and each add is O(1),
+            // the estimate is approximate but tracks the true quantile closely for smooth data.
+            // https://www.cse.wustl.edu/~jain/papers/ftp/psqr.pdf
+            class P2Quantile
+            {
+            public:
+                P2Quantile(double p = 0.5) :
+                    m_p(p),
+                    m_count(0)
+                {
+                    m_dn[0] = 0;
+                    m_dn[1] = p / 2.0;
+                    m_dn[2] = p;
+                    m_dn[3] = (1.0 + p) / 2.0;
+                    m_dn[4] = 1;
+                }
+
+                double get_quantile_level() { return m_p; }
+                std::uint64_t get_count() { return m_count; }
+
+                bool get_quantile(double& v)
+                {
+                    if(m_count == 0)
+                        return false;
+
+                    if(m_count < 5)
+                    {
+                        // Not enough samples for the markers yet so use the exact answer
+                        double tmp[5];
+                        std::copy(m_q, m_q + m_count, tmp);
+                        std::sort(tmp, tmp + m_count);
+                        v = tmp[static_cast<std::size_t>(m_p * (m_count - 1) + 0.5)];
+                        return true;
+                    }
+
+                    v = m_q[2];
+                    return true;
+                }
+
+                void add(double v)
+                {
+                    if(m_count < 5)
+                    {
+                        m_q[m_count++] = v;
+                        if(m_count == 5)
+                        {
+                            std::sort(m_q, m_q + 5);
+                            for(int i=0; i<5; ++i)
+                                m_n[i] = i;
+
+                            m_np[0] = 0;
+                            m_np[1] = 2.0 * m_p;
+                            m_np[2] = 4.0 * m_p;
+                            m_np[3] = 2.0 + 2.0 * m_p;
+                            m_np[4] = 4;
+                        }
+                        return;
+                    }
+
+                    ++m_count;
+
+                    // Find the cell the sample falls into and stretch the extremes if needed
+                    int k = 0;
+                    if(v < m_q[0])
+                    {
+                        m_q[0] = v;
+                        k = 0;
+                    }
+                    else if(v < m_q[1])
+                        k = 0;
+                    else if(v < m_q[2])
+                        k = 1;
+                    else if(v < m_q[3])
+                        k = 2;
+                    else if(v <= m_q[4])
+                        k = 3;
+                    else
+                    {
+                        m_q[4] = v;
+                        k = 3;
+                    }
+
+                    for(int i=k+1; i<5; ++i)
+                        ++m_n[i];
+                    for(int i=0; i<5; ++i)
+                        m_np[i] += m_dn[i];
+
+                    // Move the middle markers towards their desired positions
+                    for(int i=1; i<4; ++i)
+                    {
+                        double d = m_np[i] - m_n[i];
+                        if((d >= 1.0 && (m_n[i+1] - m_n[i]) > 1) || (d <= -1.0 && (m_n[i-1] - m_n[i]) < -1))
+                        {
+                            int s = (d > 0) ? 1 : -1;
+                            double q = parabolic(i, s);
+                            if(m_q[i-1] < q && q < m_q[i+1])
+                                m_q[i] = q;
+                            else
+                                m_q[i] = linear(i, s);
+                            m_n[i] += s;
+                        }
+                    }
+                }
+
+            private:
+                double parabolic(int i, int d)
+                {
+                    double n0 = m_n[i-1], n1 = m_n[i], n2 = m_n[i+1];
+                    return m_q[i] + d / (n2 - n0) * ((n1 - n0 + d) * (m_q[i+1] - m_q[i]) / (n2 - n1) +
+                                                     (n2 - n1 - d) * (m_q[i] - m_q[i-1]) / (n1 - n0));
+                }
+
+                double linear(int i, int d)
+                {
+                    return m_q[i] + d * (m_q[i+d] - m_q[i]) / (m_n[i+d] - m_n[i]);
+                }
+
+                double          m_p;
+                std::uint64_t   m_count;
+                double          m_q[5];
+                std::int64_t    m_n[5];
+                double          m_np[5];
+                double          m_dn[5];
+            };
+
+            // =====================================================================================
+            // Exact quantile of a sliding window of w samples. The window is split into a lower
+            // and an upper ordered set so the wanted order statistic is always the largest value
+            // of the lower set, inserts and evictions are O(log w). The result interpolates
+            // linearly between the two closest ranks, p = 0.5 gives the usual rolling median.
+            class RollingQuantile
+            {
+            public:
+                RollingQuantile(std::int32_t w = 500, double p = 0.5) :
+                    m_window(w > 0 ? w : 1),
+                    m_p(p),
+                    m_pos(0),
+                    m_last_value(0) {}
+
+                double get_last_value() { return m_last_value; }
+                double get_quantile_level() { return m_p; }
+                bool is_buffer_full() { return (m_values.size() >= static_cast<std::size_t>(m_window) ? true : false); }
+                double get_percent_buffered() { return (static_cast<double>(m_values.size()) / static_cast<double>(m_window)); }
+
+                bool get_quantile(double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        double pos = m_p * (m_values.size() - 1);
+                        double frac = pos - std::floor(pos);
+                        double lo = *m_low.rbegin();
+                        double hi = (frac > 0.0 && !m_high.empty()) ? *m_high.begin() : lo;
+                        v = lo + frac * (hi - lo);
+                        return true;
+                    }
+                    return false;
+                }
+
+                void add(double v)
+                {
+                    m_last_value = v;
+                    if(is_buffer_full())
+                    {
+                        // Evict the oldest sample from whichever side holds it
+                        double old = m_values[m_pos];
+                        m_values[m_pos] = v;
+                        m_pos = (m_pos + 1 == m_window) ? 0 : m_pos + 1;
+
+                        if(!m_low.empty() && old <= *m_low.rbegin())
+                            m_low.erase(m_low.find(old));
+                        else
+                            m_high.erase(m_high.find(old));
+                    }
+                    else
+                        m_values.push_back(v);
+
+                    // The eviction can empty the lower set so fall back to the upper set's minimum
+                    bool lower = !m_low.empty() ? (v <= *m_low.rbegin()) : (m_high.empty() || v <= *m_high.begin());
+                    if(lower)
+                        m_low.insert(v);
+                    else
+                        m_high.insert(v);
+
+                    rebalance();
+                }
+
+            private:
+                void rebalance()
+                {
+                    // The lower set holds every sample up to and including the target rank
+                    std::size_t target = static_cast<std::size_t>(std::floor(m_p * (m_values.size() - 1))) + 1;
+                    while(m_low.size() > target)
+                    {
+                        auto it = std::prev(m_low.end());
+                        m_high.insert(*it);
+                        m_low.erase(it);
+                    }
+                    while(m_low.size() < target && !m_high.empty())
+                    {
+                        auto it = m_high.begin();
+                        m_low.insert(*it);
+                        m_high.erase(it);
+                    }
+                }
+
+                std::int32_t            m_window;
+                double                  m_p;
+                std::int32_t            m_pos;
+                double                  m_last_value;
+                std::vector<double>     m_values;
+                std::multiset<double>   m_low;
+                std::multiset<double>   m_high;
+            };
+
+        }
+    }
+}
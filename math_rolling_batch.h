@@ -0,0 +1,247 @@
+// Columnar rolling windows for updating thousands of series per tick
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include "math_statistics.h"
+
+#include <cstdint>
+#include <vector>
+
+// =================================================================================================
+namespace chaos
+{
+    namespace math
+    {
+        namespace statistics
+        {
+            // =====================================================================================
+            // Holds N rolling windows as a structure of arrays. Every series has its own ring of
+            // w values inside one contiguous buffer and its moments are kept as running power sums,
+            // so an update is O(1) per sample and the moments for every series are refreshed in a
+            // single branch free pass the compiler can vectorize. The getters follow the same rules
+            // as RollingWindow, values are only returned once the window for the series is full.
+            class RollingWindowBatch
+            {
+            public:
+                struct Update
+                {
+                    std::uint32_t   m_series;
+                    double          m_value;
+                };
+
+                RollingWindowBatch(std::size_t series, std::int32_t w = 500, bool avg_only = false) :
+                    m_series(series),
+                    m_window(w > 0 ? w : 1),
+                    m_avg_only(avg_only),
+                    m_values(series * m_window, 0.0),
+                    m_head(series, 0),
+                    m_since_resum(series, 0),
+                    m_n(series, 0.0),
+                    m_ref(series, 0.0),
+                    m_s1(series, 0.0),
+                    m_s2(series, 0.0),
+                    m_s3(series, 0.0),
+                    m_s4(series, 0.0),
+                    m_last_value(series, 0.0),
+                    m_mean(series, 0.0),
+                    m_stdev(series, 0.0),
+                    m_skew(series, 0.0),
+                    m_kurt(series, 0.0) {}
+
+                std::size_t get_series_count() { return m_series; }
+                double get_last_value(std::uint32_t s) { return m_last_value[s]; }
+                bool is_buffer_full(std::uint32_t s) { return (m_n[s] >= m_window ? true : false); }
+                double get_percent_buffered(std::uint32_t s) { return (m_n[s] / static_cast<double>(m_window)); }
+
+                bool get_average(std::uint32_t s, double& v)
+                {
+                    if(is_buffer_full(s))
+                    {
+                        v = m_mean[s];
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool get_stdev(std::uint32_t s, double& v)
+                {
+                    if(is_buffer_full(s))
+                    {
+                        v = m_stdev[s];
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool get_skew(std::uint32_t s, double& v)
+                {
+                    if(is_buffer_full(s))
+                    {
+                        v = m_skew[s];
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool get_kurtosis(std::uint32_t s, double& v)
+                {
+                    if(is_buffer_full(s))
+                    {
+                        v = m_kurt[s];
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool get_values(std::uint32_t s, double& m, double& std, double& sk, double& ku)
+                {
+                    if(is_buffer_full(s))
+                    {
+                        m = m_mean[s];
+                        std = m_stdev[s];
+                        sk = m_skew[s];
+                        ku = m_kurt[s];
+                        return true;
+                    }
+                    return false;
+                }
+
+                // Records a single sample, the moments are refreshed on the next call to update()
+                void add(std::uint32_t s, double v)
+                {
+                    if(s < m_series)
+                        push(s, v);
+                }
+
+                // Records a batch of samples for this tick and refreshes all of the moments
+                void add(const Update* updates, std::size_t n)
+                {
+                    for(std::size_t i=0; i<n; ++i)
+                    {
+                        if(updates[i].m_series < m_series)
+                            push(updates[i].m_series, updates[i].m_value);
+                    }
+                    update();
+                }
+
+                void add(const std::vector<Update>& updates)
+                {
+                    add(updates.data(), updates.size());
+                }
+
+                void update()
+                {
+                    // Dense pass over every series, there are no branches on the series state so
+                    // this vectorizes and is cheaper than chasing the ids of the touched series
+                    double* n = m_n.data();
+                    double* k = m_ref.data();
+                    double* s1 = m_s1.data();
+                    double* mean = m_mean.data();
+                    if(m_avg_only)
+                    {
+                        for(std::size_t i=0; i<m_series; ++i)
+                            mean[i] = k[i] + s1[i] / (n[i] > 0.0 ? n[i] : 1.0);
+                        return;
+                    }
+
+                    double* s2 = m_s2.data();
+                    double* s3 = m_s3.data();
+                    double* s4 = m_s4.data();
+                    double* stdev = m_stdev.data();
+                    double* skew = m_skew.data();
+                    double* kurt = m_kurt.data();
+                    for(std::size_t i=0; i<m_series; ++i)
+                        moments_from_sums((n[i] > 0.0 ? n[i] : 1.0), k[i], s1[i], s2[i], s3[i], s4[i], mean[i], stdev[i], skew[i], kurt[i]);
+                }
+
+            private:
+                void push(std::uint32_t s, double v)
+                {
+                    std::size_t base = static_cast<std::size_t>(s) * m_window;
+                    std::int32_t head = m_head[s];
+
+                    if(m_n[s] == 0.0)
+                        m_ref[s] = v;
+
+                    double d = 0;
+                    if(m_n[s] >= m_window)
+                    {
+                        // Evict the oldest sample which is the one we are about to overwrite
+                        d = m_values[base + head] - m_ref[s];
+                        m_s1[s] -= d;
+                        m_s2[s] -= d * d;
+                        m_s3[s] -= d * d * d;
+                        m_s4[s] -= d * d * d * d;
+                    }
+                    else
+                        m_n[s] += 1.0;
+
+                    m_values[base + head] = v;
+                    m_head[s] = (head + 1 == m_window) ? 0 : head + 1;
+                    m_last_value[s] = v;
+
+                    d = v - m_ref[s];
+                    m_s1[s] += d;
+                    m_s2[s] += d * d;
+                    m_s3[s] += d * d * d;
+                    m_s4[s] += d * d * d * d;
+
+                    // Adding and removing from the sums accumulates rounding error so once every
+                    // window we rebuild them from the ring, this keeps the cost amortised O(1)
+                    if(++m_since_resum[s] >= m_window)
+                        resum(s);
+                }
+
+                void resum(std::uint32_t s)
+                {
+                    std::size_t base = static_cast<std::size_t>(s) * m_window;
+                    std::size_t n = static_cast<std::size_t>(m_n[s]);
+                    double k = m_last_value[s];
+                    double s1 = 0, s2 = 0, s3 = 0, s4 = 0, d = 0;
+
+                    // Until the window is full the samples sit at the front of the ring
+                    for(std::size_t i=0; i<n; ++i)
+                    {
+                        d = m_values[base + i] - k;
+                        s1 += d;
+                        s2 += d * d;
+                        s3 += d * d * d;
+                        s4 += d * d * d * d;
+                    }
+
+                    m_ref[s] = k;
+                    m_s1[s] = s1;
+                    m_s2[s] = s2;
+                    m_s3[s] = s3;
+                    m_s4[s] = s4;
+                    m_since_resum[s] = 0;
+                }
+
+                std::size_t                 m_series;
+                std::int32_t                m_window;
+                bool                        m_avg_only;
+
+                // Ring buffers, series s owns [s * m_window, (s + 1) * m_window)
+                std::vector<double>         m_values;
+                std::vector<std::int32_t>   m_head;
+                std::vector<std::int32_t>   m_since_resum;
+
+                // Per series state, one entry per series in each array
+                std::vector<double>         m_n;
+                std::vector<double>         m_ref;
+                std::vector<double>         m_s1;
+                std::vector<double>         m_s2;
+                std::vector<double>         m_s3;
+                std::vector<double>         m_s4;
+                std::vector<double>         m_last_value;
+                std::vector<double>         m_mean;
+                std::vector<double>         m_stdev;
+                std::vector<double>         m_skew;
+                std::vector<double>         m_kurt;
+            };
+
+        }
+    }
+}
@@ -4,12 +4,16 @@
 
 #pragma once
 
+#include "math_summation.h"
+
 #include <numeric>
 #include <string>
 #include <limits>
 #include <cmath>
 #include <algorithm>
 #include <vector>
+#include <deque>
+#include <cstdint>
 
 // =================================================================================================
 namespace chaos
@@ -96,6 +100,18 @@ namespace chaos
                 return mean_v3(c, n);
             }
 
+            // =====================================================================================
+            // Same as mean(c) with the order of the additions fixed (see math_summation.h) so the
+            // result doesn't move with -ffast-math or the build. Needs a contiguous container.
+            template <class T>
+            static double mean(T& c, SummationMode mode)
+            {
+                if(mode == SM_Fast)
+                    return mean(c);
+
+                return (sum(c.data(), c.size(), mode) / c.size());
+            }
+
             // =====================================================================================
             template <class T>
             static double stdev_v1(T& c)
@@ -246,16 +262,146 @@ namespace chaos
                 ku = ((n * r) / (q * q)) - 3;
             }
 
+            // =====================================================================================
+            // Same as above with a bounded error summation for the mean and the power sums
+            template <class T>
+            static void moments(T& c, double& m, double& std, double& sk, double& ku, SummationMode mode)
+            {
+                if(mode == SM_Fast)
+                {
+                    moments(c, m, std, sk, ku);
+                    return;
+                }
+
+                double q = 0, r = 0, s = 0;
+                std::size_t n = c.size();
+                m = sum(c.data(), n, mode) / n;
+                power_sums(c.data(), n, m, mode, q, s, r);
+
+                std = std::sqrt(q/n);
+                sk = s / (n * std * std * std);
+                ku = ((n * r) / (q * q)) - 3;
+            }
+
+            // =====================================================================================
+            // Same population moments as above but derived from running power sums of (x - k),
+            // where k is a reference value close to the data (shifting keeps the sums small so we
+            // don't lose precision when the values are prices far from zero).
+            static inline void moments_from_sums(double n, double k, double s1, double s2, double s3, double s4,
+                                                 double& m, double& std, double& sk, double& ku)
+            {
+                double inv = 1.0 / n;
+                double d = s1 * inv;
+                double d2 = d * d;
+                double m2 = s2 * inv - d2;
+                double m3 = s3 * inv - 3.0 * d * s2 * inv + 2.0 * d2 * d;
+                double m4 = s4 * inv - 4.0 * d * s3 * inv + 6.0 * d2 * s2 * inv - 3.0 * d2 * d2;
+
+                // Rounding can push a flat series slightly negative
+                m2 = (m2 > 0.0) ? m2 : 0.0;
+                double v = (m2 > 0.0) ? m2 : 1.0;
+
+                m = k + d;
+                std = std::sqrt(m2);
+                sk = (m2 > 0.0) ? (m3 / (v * std::sqrt(v))) : 0.0;
+                ku = (m2 > 0.0) ? ((m4 / (v * v)) - 3.0) : 0.0;
+            }
+
+            // =====================================================================================
+            // Minimum and maximum of the last w samples in amortised O(1) per add. Each side keeps
+            // a monotonic queue of the samples that can still become the extreme, anything that is
+            // dominated by a newer sample or has left the window is dropped. The queues live in
+            // fixed rings of w entries so there is no allocation after construction.
+            class SlidingMinMax
+            {
+            public:
+                SlidingMinMax(std::int32_t w = 500) :
+                    m_window(w > 0 ? w : 1),
+                    m_seq(0),
+                    m_max(m_window),
+                    m_min(m_window) {}
+
+                bool is_buffer_full() { return (m_seq >= static_cast<std::uint64_t>(m_window) ? true : false); }
+                bool is_empty() { return (m_seq == 0 ? true : false); }
+                double get_min() { return m_min.front(); }
+                double get_max() { return m_max.front(); }
+                double get_range() { return m_max.front() - m_min.front(); }
+
+                void add(double v)
+                {
+                    m_max.push(v, m_seq, m_window, true);
+                    m_min.push(v, m_seq, m_window, false);
+                    ++m_seq;
+                }
+
+            private:
+                struct MonotonicQueue
+                {
+                    MonotonicQueue(std::int32_t capacity) :
+                        m_seqs(capacity, 0),
+                        m_values(capacity, 0.0),
+                        m_head(0),
+                        m_size(0) {}
+
+                    double front() { return (m_size > 0) ? m_values[m_head] : 0.0; }
+
+                    void push(double v, std::uint64_t seq, std::uint64_t window, bool keep_max)
+                    {
+                        std::size_t capacity = m_values.size();
+
+                        // Expire the front once it falls out of the window
+                        while(m_size > 0 && (m_seqs[m_head] + window) <= seq)
+                        {
+                            m_head = (m_head + 1 == capacity) ? 0 : m_head + 1;
+                            --m_size;
+                        }
+
+                        // Drop everything at the back the new sample dominates
+                        while(m_size > 0)
+                        {
+                            std::size_t back = (m_head + m_size - 1) % capacity;
+                            if(keep_max ? (m_values[back] > v) : (m_values[back] < v))
+                                break;
+                            --m_size;
+                        }
+
+                        std::size_t tail = (m_head + m_size) % capacity;
+                        m_seqs[tail] = seq;
+                        m_values[tail] = v;
+                        ++m_size;
+                    }
+
+                    std::vector<std::uint64_t>  m_seqs;
+                    std::vector<double>         m_values;
+                    std::size_t                 m_head;
+                    std::size_t                 m_size;
+                };
+
+                std::int32_t    m_window;
+                std::uint64_t   m_seq;
+                MonotonicQueue  m_max;
+                MonotonicQueue  m_min;
+            };
+
             // =====================================================================================
             // If we have a vector which is constantly updating then we want to optimize the mean
             // calculation. We can do this by keeping a rolling sum. This will speed everything up
-            // and reflects how we actually use it in real life.
+            // and reflects how we actually use it in real life. The summation mode picks how the
+            // window is summed, SM_Kahan or SM_Pairwise give the same values on every build.
+            //
+            // In lazy mode add() only stores the sample and the moments are worked out on the next
+            // read, so a fast feed that is read on a timer only pays for the reads. The moments are
+            // the same either way but the min / max vol only see the stdev at each read, not after
+            // every add or while the window is still filling.
             class RollingWindow
             {
             public:
-                RollingWindow(std::int32_t w = 500, bool avg_only = false) :
+                RollingWindow(std::int32_t w = 500, bool avg_only = false, SummationMode mode = SM_Fast, bool lazy = false) :
                     m_window(w),
                     m_avg_only(avg_only),
+                    m_mode(mode),
+                    m_lazy(lazy),
+                    m_dirty(false),
                     m_last_value(0),
                     m_mean(0),
                     m_stdev(0),
@@ -263,18 +409,26 @@ namespace chaos
                     m_skew(0),
                     m_kurt(0),
                     m_min(999999999.999999),
-                    m_max(-999999999.999999) {}
+                    m_max(-999999999.999999),
+                    m_pos(0),
+                    m_extremes(w),
+                    m_vol_extremes(w) {}
 
                 double get_last_value() { return m_last_value; }
                 bool is_buffer_full() { return (m_values.size() >= m_window ? true : false); }
                 double get_percent_buffered() { return (static_cast<double>(m_values.size()) / static_cast<double>(m_window)); }
-                double get_min() { return m_min; }
-                double get_max() { return m_max; }
+                double get_min() { refresh(); return m_min; }
+                double get_max() { refresh(); return m_max; }
+                SummationMode get_summation_mode() { return m_mode; }
+                void set_summation_mode(SummationMode mode) { m_mode = mode; }
+                bool is_lazy() { return m_lazy; }
+                void set_lazy(bool lazy) { refresh(); m_lazy = lazy; }
 
                 bool get_average(double& v)
                 {
                     if(is_buffer_full())
                     {
+                        refresh();
                         v = m_mean;
                         return true;
                     }
@@ -285,6 +439,7 @@ namespace chaos
                 {
                     if(is_buffer_full())
                     {
+                        refresh();
                         v = m_stdev;
                         return true;
                     }
@@ -295,6 +450,7 @@ namespace chaos
                 {
                     if(is_buffer_full())
                     {
+                        refresh();
                         v = m_skew;
                         return true;
                     }
@@ -305,6 +461,7 @@ namespace chaos
                 {
                     if(is_buffer_full())
                     {
+                        refresh();
                         v = m_kurt;
                         return true;
                     }
@@ -315,6 +472,7 @@ namespace chaos
                 {
                     if(is_buffer_full())
                     {
+                        refresh();
                         v = m_min_max_vol;
                         return true;
                     }
@@ -325,6 +483,7 @@ namespace chaos
                 {
                     if(is_buffer_full())
                     {
+                        refresh();
                         m = m_mean;
                         std = m_stdev;
                         sk = m_skew;
@@ -334,29 +493,103 @@ namespace chaos
                     return false;
                 }
 
+                // Smallest value currently in the window
+                bool get_value_min(double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        v = m_extremes.get_min();
+                        return true;
+                    }
+                    return false;
+                }
+
+                // Largest value currently in the window
+                bool get_value_max(double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        v = m_extremes.get_max();
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool get_range(double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        v = m_extremes.get_range();
+                        return true;
+                    }
+                    return false;
+                }
+
+                // Same as get_min_max_vol() but the min and max only cover the last window of
+                // stdev values so it follows a change in regime instead of holding on to it
+                bool get_rolling_min_max_vol(double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        refresh();
+                        if(!m_vol_extremes.is_empty())
+                        {
+                            v = (m_vol_extremes.get_min() + m_vol_extremes.get_max()) / 2.0;
+                            return true;
+                        }
+                    }
+                    return false;
+                }
+
                 void add(double v)
                 {
                     m_last_value = v;
-                    m_values.push_back(v);
-                    if(m_values.size() > m_window)
-                        m_values.erase(m_values.begin());
+                    m_extremes.add(v);
+
+                    // The order of the samples doesn't matter to the moments so once the buffer is
+                    // full we overwrite the oldest one in place instead of shifting the vector
+                    if(m_values.size() < m_window)
+                        m_values.push_back(v);
+                    else
+                    {
+                        m_values[m_pos] = v;
+                        m_pos = (m_pos + 1 == m_window) ? 0 : m_pos + 1;
+                    }
 
                     // Only start once the buffer is 75% full
                     if(m_values.size() > (m_window * .75))
                     {
-                        // Do we only care about the mean
-                        if(m_avg_only)
-                            m_mean = mean(m_values);
+                        if(m_lazy)
+                            m_dirty = true;
                         else
-                        {
-                            // We need to calculate all of the moments
-                            moments(m_values, m_mean, m_stdev, m_skew, m_kurt);
-                            vol_min_max_check();
-                        }
+                            calculate();
                     }
                 }
 
             private:
+                void calculate()
+                {
+                    // Do we only care about the mean
+                    if(m_avg_only)
+                        m_mean = mean(m_values, m_mode);
+                    else
+                    {
+                        // We need to calculate all of the moments
+                        moments(m_values, m_mean, m_stdev, m_skew, m_kurt, m_mode);
+                        vol_min_max_check();
+                    }
+                }
+
+                // Catch up on the samples added since the last read
+                void refresh()
+                {
+                    if(m_dirty)
+                    {
+                        m_dirty = false;
+                        calculate();
+                    }
+                }
+
                 void vol_min_max_check()
                 {
                     // Vol over time can become very small if the updates stop changing frequently
@@ -370,11 +603,15 @@ namespace chaos
                             m_max = m_stdev;
 
                         m_min_max_vol = (m_min + m_max) / 2.0;
+                        m_vol_extremes.add(m_stdev);
                     }
                 }
 
                 std::int32_t    m_window;
                 bool            m_avg_only;
+                SummationMode   m_mode;
+                bool            m_lazy;
+                bool            m_dirty;
                 double          m_last_value;
                 double          m_mean;
                 double          m_stdev;
@@ -383,10 +620,298 @@ namespace chaos
                 double          m_kurt;
                 double          m_min;
                 double          m_max;
+                std::int32_t    m_pos;
+                SlidingMinMax   m_extremes;
+                SlidingMinMax   m_vol_extremes;
 
                 std::vector<double> m_values;
             };
 
+            // =====================================================================================
+            // Exponentially weighted moments in O(1) memory. By default every sample carries the
+            // same decay, alpha = 2 / (span + 1), which roughly matches a RollingWindow of the same
+            // size. When a half life is given the samples should be added with a timestamp and the
+            // decay depends on the time between them, the timestamp can be get_point_in_time() or
+            // nanoseconds as long as the half life uses the same unit. Samples with the same
+            // timestamp share the weight of that moment equally.
+            class ExponentialWindow
+            {
+            public:
+                ExponentialWindow(double span = 500, std::uint64_t half_life = 0, std::int32_t min_samples = -1) :
+                    m_alpha(2.0 / ((span > 1.0 ? span : 1.0) + 1.0)),
+                    m_half_life(half_life),
+                    m_min_samples(min_samples < 0 ? static_cast<std::int32_t>(span) : min_samples),
+                    m_count(0),
+                    m_last_ts(0),
+                    m_weight(0),
+                    m_last_value(0),
+                    m_ref(0),
+                    m_e1(0),
+                    m_e2(0),
+                    m_e3(0),
+                    m_e4(0) {}
+
+                double get_last_value() { return m_last_value; }
+                bool is_buffer_full() { return (m_count >= static_cast<std::uint64_t>(m_min_samples) ? true : false); }
+
+                bool get_average(double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        v = m_ref + m_e1;
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool get_stdev(double& v)
+                {
+                    double m, sk, ku;
+                    return get_values(m, v, sk, ku);
+                }
+
+                bool get_skew(double& v)
+                {
+                    double m, std, ku;
+                    return get_values(m, std, v, ku);
+                }
+
+                bool get_kurtosis(double& v)
+                {
+                    double m, std, sk;
+                    return get_values(m, std, sk, v);
+                }
+
+                bool get_values(double& m, double& std, double& sk, double& ku)
+                {
+                    if(is_buffer_full())
+                    {
+                        // The weights already sum to one so the averages stand in for the sums
+                        moments_from_sums(1.0, m_ref, m_e1, m_e2, m_e3, m_e4, m, std, sk, ku);
+                        return true;
+                    }
+                    return false;
+                }
+
+                void add(double v)
+                {
+                    update(v, m_alpha);
+                }
+
+                void add(double v, std::uint64_t ts)
+                {
+                    double a = m_alpha;
+                    if(m_half_life > 0)
+                    {
+                        // Weight of the history halves every half life and each sample adds one,
+                        // so a sample with no time since the last still counts
+                        double dt = (m_count > 0 && ts > m_last_ts) ? static_cast<double>(ts - m_last_ts) : 0.0;
+                        m_weight = m_weight * std::exp2(-dt / static_cast<double>(m_half_life)) + 1.0;
+                        a = 1.0 / m_weight;
+                    }
+                    m_last_ts = ts;
+                    update(v, a);
+                }
+
+            private:
+                void update(double v, double a)
+                {
+                    m_last_value = v;
+                    if(m_count++ == 0)
+                    {
+                        m_ref = v;
+                        return;
+                    }
+
+                    double d = v - m_ref;
+                    double b = 1.0 - a;
+                    m_e1 = b * m_e1 + a * d;
+                    m_e2 = b * m_e2 + a * d * d;
+                    m_e3 = b * m_e3 + a * d * d * d;
+                    m_e4 = b * m_e4 + a * d * d * d * d;
+
+                    // Re-centre on the mean now and again so the raw moments stay small, the
+                    // binomial expansion moves them to the new reference without any error
+                    if(m_count % 256 == 0)
+                        recentre(m_e1);
+                }
+
+                void recentre(double delta)
+                {
+                    double d2 = delta * delta;
+                    double d3 = d2 * delta;
+                    double e1 = m_e1, e2 = m_e2, e3 = m_e3;
+                    m_e4 = m_e4 - 4.0 * delta * e3 + 6.0 * d2 * e2 - 4.0 * d3 * e1 + d2 * d2;
+                    m_e3 = e3 - 3.0 * delta * e2 + 3.0 * d2 * e1 - d3;
+                    m_e2 = e2 - 2.0 * delta * e1 + d2;
+                    m_e1 = e1 - delta;
+                    m_ref += delta;
+                }
+
+                double          m_alpha;
+                std::uint64_t   m_half_life;
+                std::int32_t    m_min_samples;
+                std::uint64_t   m_count;
+                std::uint64_t   m_last_ts;
+                double          m_weight;
+                double          m_last_value;
+                double          m_ref;
+                double          m_e1;
+                double          m_e2;
+                double          m_e3;
+                double          m_e4;
+            };
+
+            // =====================================================================================
+            // Rolling window keyed by time instead of by count. Samples older than the window
+            // length are evicted on every add, the timestamps can be get_point_in_time() or
+            // nanoseconds as long as the length uses the same unit and they never go backwards.
+            // The window is full once it has seen a whole window length of data.
+            class TimeWindow
+            {
+            public:
+                TimeWindow(std::uint64_t length, bool avg_only = false) :
+                    m_length(length),
+                    m_avg_only(avg_only),
+                    m_first_ts(0),
+                    m_last_ts(0),
+                    m_since_resum(0),
+                    m_last_value(0),
+                    m_ref(0),
+                    m_s1(0),
+                    m_s2(0),
+                    m_s3(0),
+                    m_s4(0),
+                    m_mean(0),
+                    m_stdev(0),
+                    m_skew(0),
+                    m_kurt(0) {}
+
+                double get_last_value() { return m_last_value; }
+                std::size_t get_count() { return m_values.size(); }
+                bool is_buffer_full() { return ((!m_values.empty() && (m_last_ts - m_first_ts) >= m_length) ? true : false); }
+
+                bool get_average(double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        v = m_mean;
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool get_stdev(double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        v = m_stdev;
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool get_skew(double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        v = m_skew;
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool get_kurtosis(double& v)
+                {
+                    if(is_buffer_full())
+                    {
+                        v = m_kurt;
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool get_values(double& m, double& std, double& sk, double& ku)
+                {
+                    if(is_buffer_full())
+                    {
+                        m = m_mean;
+                        std = m_stdev;
+                        sk = m_skew;
+                        ku = m_kurt;
+                        return true;
+                    }
+                    return false;
+                }
+
+                void add(double v, std::uint64_t ts)
+                {
+                    if(m_values.empty() && m_first_ts == 0)
+                    {
+                        m_first_ts = ts;
+                        m_ref = v;
+                    }
+                    m_last_ts = ts;
+                    m_last_value = v;
+                    m_values.push_back(std::make_pair(ts, v));
+                    accumulate(v, 1.0);
+
+                    // Evict everything that has aged out of the window
+                    while(!m_values.empty() && (ts - m_values.front().first) >= m_length)
+                    {
+                        accumulate(m_values.front().second, -1.0);
+                        m_values.pop_front();
+                    }
+
+                    // Rebuild the sums once per window worth of samples to bound rounding error
+                    if(++m_since_resum >= m_values.size())
+                        resum();
+
+                    double n = static_cast<double>(m_values.size());
+                    if(m_avg_only)
+                        m_mean = m_ref + m_s1 / n;
+                    else
+                        moments_from_sums(n, m_ref, m_s1, m_s2, m_s3, m_s4, m_mean, m_stdev, m_skew, m_kurt);
+                }
+
+            private:
+                void accumulate(double v, double sign)
+                {
+                    double d = v - m_ref;
+                    m_s1 += sign * d;
+                    m_s2 += sign * d * d;
+                    m_s3 += sign * d * d * d;
+                    m_s4 += sign * d * d * d * d;
+                }
+
+                void resum()
+                {
+                    m_ref = m_last_value;
+                    m_s1 = m_s2 = m_s3 = m_s4 = 0;
+                    for(auto it=m_values.begin(); it!=m_values.end(); ++it)
+                        accumulate(it->second, 1.0);
+                    m_since_resum = 0;
+                }
+
+                std::uint64_t   m_length;
+                bool            m_avg_only;
+                std::uint64_t   m_first_ts;
+                std::uint64_t   m_last_ts;
+                std::size_t     m_since_resum;
+                double          m_last_value;
+                double          m_ref;
+                double          m_s1;
+                double          m_s2;
+                double          m_s3;
+                double          m_s4;
+                double          m_mean;
+                double          m_stdev;
+                double          m_skew;
+                double          m_kurt;
+
+                std::deque<std::pair<std::uint64_t, double> > m_values;
+            };
+
         }
     }
 }
@@ -0,0 +1,357 @@
+// Summation kernels with a fixed order of operations for the statistics
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// =================================================================================================
+namespace chaos
+{
+    namespace math
+    {
+        namespace statistics
+        {
+            // =====================================================================================
+            // How a sum over a window is accumulated
+            //
+            //      SM_Fast     - a plain loop, under -ffast-math the compiler is free to split and
+            //                    reorder it so the last bits depend on the build
+            //      SM_Kahan    - compensated summation, the error doesn't grow with the length
+            //      SM_Pairwise - blocks of 128 summed in 8 lanes and the blocks added as a binary
+            //                    tree, the error grows with log(n) and it is the faster of the two
+            //
+            // SM_Kahan and SM_Pairwise fix the order of every addition in the code and keep the
+            // compiler from changing it, so the result only depends on the data: the same bits
+            // with or without -ffast-math, FMA contraction or SSE2.
+            enum SummationMode
+            {
+                SM_Fast,
+                SM_Kahan,
+                SM_Pairwise
+            };
+
+            // -ffloat-store is for the x87 and only costs a store and a load per variable with SSE2
+            // math, where the barriers below already pin every rounding
+#if defined(__SSE2_MATH__) && defined(__GNUC__) && !defined(__clang__)
+#define CHAOS_SUMMATION_NO_FLOAT_STORE
+#pragma GCC push_options
+#pragma GCC optimize("no-float-store")
+#endif
+
+            // =====================================================================================
+            namespace summation
+            {
+                static const std::size_t    LANES = 8;
+                static const std::size_t    PAIRWISE_BLOCK = 128;
+
+#ifdef __SSE2__
+                typedef __m128d Pair;
+                static inline Pair pair_zero() { return _mm_setzero_pd(); }
+                static inline Pair pair_set(double v) { return _mm_set1_pd(v); }
+                static inline Pair pair_load(const double* p) { return _mm_loadu_pd(p); }
+                static inline void pair_store(double* p, Pair a) { _mm_storeu_pd(p, a); }
+                static inline Pair pair_add(Pair a, Pair b) { return _mm_add_pd(a, b); }
+                static inline Pair pair_sub(Pair a, Pair b) { return _mm_sub_pd(a, b); }
+                static inline Pair pair_mul(Pair a, Pair b) { return _mm_mul_pd(a, b); }
+
+                // The compiler can't see through an empty asm so it can't reassociate across it or
+                // fuse a multiply into the add that follows, and it costs no instructions
+                static inline void opaque(Pair& a) { asm("" : "+x"(a)); }
+                static inline void opaque(double& v) { asm("" : "+x"(v)); }
+#else
+                // The same two lanes in plain doubles, the results match the SSE2 ones bit for bit
+                struct Pair
+                {
+                    double  m_lo;
+                    double  m_hi;
+                };
+                static inline Pair pair_make(double lo, double hi) { Pair p = { lo, hi }; return p; }
+                static inline Pair pair_zero() { return pair_make(0.0, 0.0); }
+                static inline Pair pair_set(double v) { return pair_make(v, v); }
+                static inline Pair pair_load(const double* p) { return pair_make(p[0], p[1]); }
+                static inline void pair_store(double* p, Pair a) { p[0] = a.m_lo; p[1] = a.m_hi; }
+                static inline Pair pair_add(Pair a, Pair b) { return pair_make(a.m_lo + b.m_lo, a.m_hi + b.m_hi); }
+                static inline Pair pair_sub(Pair a, Pair b) { return pair_make(a.m_lo - b.m_lo, a.m_hi - b.m_hi); }
+                static inline Pair pair_mul(Pair a, Pair b) { return pair_make(a.m_lo * b.m_lo, a.m_hi * b.m_hi); }
+#if defined(__GNUC__)
+                static inline void opaque(Pair& a) { asm("" : "+m"(a)); }
+                static inline void opaque(double& v) { asm("" : "+m"(v)); }
+#else
+                static inline void opaque(Pair& a) { volatile Pair tmp = a; a = tmp; }
+                static inline void opaque(double& v) { volatile double tmp = v; v = tmp; }
+#endif
+#endif
+
+                // =================================================================================
+                // Eight values as four pairs, a short block is padded so the lanes stay lined up
+                static inline void load_block(const double* x, std::size_t n, double pad, Pair (&v)[4])
+                {
+                    if(n >= LANES)
+                    {
+                        for(std::size_t j=0; j<4; ++j)
+                            v[j] = pair_load(x + j * 2);
+                        return;
+                    }
+
+                    double tmp[LANES];
+                    for(std::size_t j=0; j<LANES; ++j)
+                        tmp[j] = (j < n) ? x[j] : pad;
+                    for(std::size_t j=0; j<4; ++j)
+                        v[j] = pair_load(tmp + j * 2);
+                }
+
+                // =================================================================================
+                static inline void kahan_add(double& s, double& c, double x)
+                {
+                    double y = x - c;
+                    opaque(y);
+                    double t = s + y;
+                    opaque(t);
+                    double d = t - s;
+                    opaque(d);
+                    c = d - y;
+                    opaque(c);
+                    s = t;
+                }
+
+                // =================================================================================
+                // Lane j only ever sees element j of each block, added in turn
+                struct PlainLanes
+                {
+                    Pair    m_sum[4];
+
+                    PlainLanes()
+                    {
+                        for(std::size_t j=0; j<4; ++j)
+                            m_sum[j] = pair_zero();
+                    }
+
+                    void add(const Pair (&v)[4])
+                    {
+                        for(std::size_t j=0; j<4; ++j)
+                        {
+                            m_sum[j] = pair_add(m_sum[j], v[j]);
+                            opaque(m_sum[j]);
+                        }
+                    }
+
+                    double total()
+                    {
+                        // (0 + 4) + (2 + 6) and (1 + 5) + (3 + 7), then the two halves
+                        Pair a = pair_add(m_sum[0], m_sum[2]);
+                        opaque(a);
+                        Pair b = pair_add(m_sum[1], m_sum[3]);
+                        opaque(b);
+                        Pair c = pair_add(a, b);
+                        opaque(c);
+                        double lanes[2];
+                        pair_store(lanes, c);
+                        return lanes[0] + lanes[1];
+                    }
+                };
+
+                // =================================================================================
+                // Kahan in every lane, the lanes and what they lost are folded with a scalar Kahan
+                struct KahanLanes
+                {
+                    Pair    m_sum[4];
+                    Pair    m_comp[4];
+
+                    KahanLanes()
+                    {
+                        for(std::size_t j=0; j<4; ++j)
+                            m_sum[j] = m_comp[j] = pair_zero();
+                    }
+
+                    void add(const Pair (&v)[4])
+                    {
+                        for(std::size_t j=0; j<4; ++j)
+                        {
+                            Pair y = pair_sub(v[j], m_comp[j]);
+                            opaque(y);
+                            Pair t = pair_add(m_sum[j], y);
+                            opaque(t);
+                            Pair d = pair_sub(t, m_sum[j]);
+                            opaque(d);
+                            m_comp[j] = pair_sub(d, y);
+                            opaque(m_comp[j]);
+                            m_sum[j] = t;
+                        }
+                    }
+
+                    double total()
+                    {
+                        double sums[LANES], comps[LANES];
+                        for(std::size_t j=0; j<4; ++j)
+                        {
+                            pair_store(sums + j * 2, m_sum[j]);
+                            pair_store(comps + j * 2, m_comp[j]);
+                        }
+
+                        double s = 0, c = 0;
+                        for(std::size_t j=0; j<LANES; ++j)
+                            kahan_add(s, c, sums[j]);
+                        for(std::size_t j=0; j<LANES; ++j)
+                            kahan_add(s, c, -comps[j]);
+                        return s - c;
+                    }
+                };
+
+                // =================================================================================
+                template <class Lanes>
+                static inline void accumulate(Lanes& lanes, const double* x, std::size_t n)
+                {
+                    Pair v[4];
+                    for(std::size_t i=0; i<n; i+=LANES)
+                    {
+                        load_block(x + i, n - i, 0.0, v);
+                        lanes.add(v);
+                    }
+                }
+
+                // Sums of (x - m)^2, (x - m)^3 and (x - m)^4, the padding is m so it adds nothing
+                template <class Lanes>
+                static inline void accumulate_powers(Lanes& s2, Lanes& s3, Lanes& s4, const double* x, std::size_t n, double m)
+                {
+                    Pair mv = pair_set(m);
+                    Pair v[4], d2[4], d3[4], d4[4];
+                    for(std::size_t i=0; i<n; i+=LANES)
+                    {
+                        load_block(x + i, n - i, m, v);
+                        for(std::size_t j=0; j<4; ++j)
+                        {
+                            Pair d = pair_sub(v[j], mv);
+                            d2[j] = pair_mul(d, d);
+                            opaque(d2[j]);
+                            d3[j] = pair_mul(d2[j], d);
+                            opaque(d3[j]);
+                            d4[j] = pair_mul(d2[j], d2[j]);
+                            opaque(d4[j]);
+                        }
+                        s2.add(d2);
+                        s3.add(d3);
+                        s4.add(d4);
+                    }
+                }
+
+                // =================================================================================
+                // The split is on a multiple of the lane count so every block but the last is full
+                static double pairwise_sum(const double* x, std::size_t n)
+                {
+                    if(n <= PAIRWISE_BLOCK)
+                    {
+                        PlainLanes lanes;
+                        accumulate(lanes, x, n);
+                        return lanes.total();
+                    }
+
+                    std::size_t half = (n / 2) & ~(LANES - 1);
+                    double left = pairwise_sum(x, half);
+                    opaque(left);
+                    double right = pairwise_sum(x + half, n - half);
+                    opaque(right);
+                    return left + right;
+                }
+
+                static void pairwise_powers(const double* x, std::size_t n, double m, double& s2, double& s3, double& s4)
+                {
+                    if(n <= PAIRWISE_BLOCK)
+                    {
+                        PlainLanes l2, l3, l4;
+                        accumulate_powers(l2, l3, l4, x, n, m);
+                        s2 = l2.total();
+                        s3 = l3.total();
+                        s4 = l4.total();
+                        return;
+                    }
+
+                    std::size_t half = (n / 2) & ~(LANES - 1);
+                    double a2, a3, a4, b2, b3, b4;
+                    pairwise_powers(x, half, m, a2, a3, a4);
+                    pairwise_powers(x + half, n - half, m, b2, b3, b4);
+                    opaque(a2);
+                    opaque(a3);
+                    opaque(a4);
+                    opaque(b2);
+                    opaque(b3);
+                    opaque(b4);
+                    s2 = a2 + b2;
+                    s3 = a3 + b3;
+                    s4 = a4 + b4;
+                }
+            }
+
+            // =====================================================================================
+            static inline double sum(const double* x, std::size_t n, SummationMode mode = SM_Pairwise)
+            {
+                switch(mode)
+                {
+                    case SM_Kahan:
+                    {
+                        summation::KahanLanes lanes;
+                        summation::accumulate(lanes, x, n);
+                        return lanes.total();
+                    }
+                    case SM_Pairwise:
+                        return summation::pairwise_sum(x, n);
+                    default:
+                    {
+                        double s = 0;
+                        for(std::size_t i=0; i<n; ++i)
+                            s += x[i];
+                        return s;
+                    }
+                }
+            }
+
+            // =====================================================================================
+            // The central power sums about m, what moments() needs after the mean
+            static inline void power_sums(const double* x, std::size_t n, double m, SummationMode mode,
+                                          double& s2, double& s3, double& s4)
+            {
+                switch(mode)
+                {
+                    case SM_Kahan:
+                    {
+                        summation::KahanLanes l2, l3, l4;
+                        summation::accumulate_powers(l2, l3, l4, x, n, m);
+                        s2 = l2.total();
+                        s3 = l3.total();
+                        s4 = l4.total();
+                        break;
+                    }
+                    case SM_Pairwise:
+                        summation::pairwise_powers(x, n, m, s2, s3, s4);
+                        break;
+                    default:
+                    {
+                        double q = 0, r = 0, s = 0, v = 0;
+                        for(std::size_t i=0; i<n; ++i)
+                        {
+                            v = x[i] - m;
+                            q += v * v;
+                            s += v * v * v;
+                            r += v * v * v * v;
+                        }
+                        s2 = q;
+                        s3 = s;
+                        s4 = r;
+                        break;
+                    }
+                }
+            }
+
+#ifdef CHAOS_SUMMATION_NO_FLOAT_STORE
+#pragma GCC pop_options
+#undef CHAOS_SUMMATION_NO_FLOAT_STORE
+#endif
+        }
+    }
+}
@@ -0,0 +1,307 @@
+// Publishes log events and heartbeats to mother from its own thread
+//
+// Copyright HOLM, 2023
+
+#include "pch.h"
+#include "mother_publisher.h"
+#include "logger.h"
+#include "utils.h"
+#include "application_details.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include <boost/bind/bind.hpp>
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    namespace mother_publisher
+    {
+        static const std::size_t    BATCH_SIZE = 64;
+        static const std::uint32_t  DEFAULT_RATE = 50;
+        static const std::uint32_t  DEFAULT_QUEUE = 4096;
+    }
+
+    // ===============================================================================================
+    static std::uint32_t env_or_default(const std::string& variable, std::uint32_t def)
+    {
+        std::uint32_t value = chaos::get_environment_int(variable);
+        return (value == 0) ? def : value;
+    }
+
+    // ===============================================================================================
+    MotherPublisher::MotherPublisher(const std::string& application_name) :
+        m_timer(m_io, boost::posix_time::seconds(1)),
+        m_thread(NULL),
+        m_mother(NULL),
+        m_queue(env_or_default("CHAOS_MOTHER_QUEUE", mother_publisher::DEFAULT_QUEUE)),
+        m_queued(false),
+        m_notified(false),
+        m_dropped(0),
+        m_stopped(false),
+        m_batch(mother_publisher::BATCH_SIZE),
+        m_batch_count(0),
+        m_have_last(false),
+        m_repeats(0),
+        m_rate(env_or_default("CHAOS_MOTHER_RATE", mother_publisher::DEFAULT_RATE)),
+        m_tokens(m_rate),
+        m_last_refill(boost::posix_time::microsec_clock::universal_time()),
+        m_throttled(0),
+        m_throttled_reported(0),
+        m_dropped_reported(0),
+        m_coalesced(0),
+        m_heartbeat_counter(0)
+    {
+        auto app_desc = chaos::ApplicationDetails::instance();
+        // We will only be publishing messages from this object
+        m_mother = new chaos::Udp(m_io, app_desc->get_mothers_address(), app_desc->get_mothers_port(), false, false);
+
+        // The message object for the mother heartbeat, the snapshot fields are already sized to match
+        chaos::ApplicationSnapshot snapshot;
+        app_desc->get_snapshot(snapshot);
+        chaos::FixedString<SIZE_80> application(application_name);
+        chaos::FixedString<SIZE_80> host(boost::asio::ip::host_name());
+        m_mother_msg.clear();
+        m_mother_msg.header.m_type = chaos::MessageTypes::MOTHER;
+        m_mother_msg.header.m_length = m_mother_msg.mother.getLength();
+        application.copy_to(m_mother_msg.mother.m_application);
+        snapshot.m_description.copy_to(m_mother_msg.mother.m_description);
+        snapshot.m_location.copy_to(m_mother_msg.mother.m_location);
+        snapshot.m_application.copy_to(m_mother_msg.mother.m_instance);
+        host.copy_to(m_mother_msg.mother.m_host);
+        snapshot.m_start_time.copy_to(m_mother_msg.mother.m_start_time);
+        snapshot.m_version.copy_to(m_mother_msg.mother.m_version);
+        m_mother_msg.mother.m_pid = chaos::get_pid();
+        m_mother_msg.mother.m_tcp_pid = app_desc->get_application_tcp_port();
+        m_mother_msg.mother.m_udp_port = app_desc->get_application_tcp_port();
+
+        // The message object for the event log
+        m_log_msg.clear();
+        m_log_msg.header.m_type = chaos::MessageTypes::LOG;
+        m_log_msg.header.m_length = m_log_msg.log.getLength();
+        application.copy_to(m_log_msg.log.m_application);
+        snapshot.m_application.copy_to(m_log_msg.log.m_instance);
+        host.copy_to(m_log_msg.log.m_host);
+
+        m_timer.async_wait(boost::bind(&MotherPublisher::on_timer, this));
+        m_thread = new boost::thread(&MotherPublisher::publisher_thread, this);
+    }
+
+    // ===============================================================================================
+    MotherPublisher::~MotherPublisher()
+    {
+        stop();
+
+        delete m_mother;
+        m_mother = NULL;
+    }
+
+    // ===============================================================================================
+    void MotherPublisher::stop()
+    {
+        if (m_stopped.exchange(true))
+            return;
+
+        m_io.stop();
+        if (m_thread)
+        {
+            m_thread->join();
+            delete m_thread;
+            m_thread = NULL;
+        }
+
+        // The thread is gone so we are the only consumer now, send what is left
+        drain();
+        flush_repeats();
+        send_pending();
+    }
+
+    // ===============================================================================================
+    void MotherPublisher::publisher_thread()
+    {
+        chaos::set_thread_name("Mother");
+
+        boost::asio::io_service::work work(m_io);
+        m_io.run();
+    }
+
+    // ===============================================================================================
+    void MotherPublisher::publish(std::int32_t state, const std::string& msg)
+    {
+        // 1023 characters is the most we can send, anything longer is truncated
+        Item item;
+        item.m_state = state;
+        item.m_msg = msg;
+
+        if (m_queue.push(item))
+            m_queued = true;
+        else
+            m_dropped.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    // ===============================================================================================
+    void MotherPublisher::notify()
+    {
+        // One wake up per batch, the publisher clears the flag before it starts draining
+        if (!m_queued || m_stopped.load(boost::memory_order_relaxed))
+            return;
+
+        m_queued = false;
+        if (!m_notified.exchange(true))
+            m_io.post(boost::bind(&MotherPublisher::drain, this));
+    }
+
+    // ===============================================================================================
+    void MotherPublisher::drain()
+    {
+        m_notified.store(false);
+        refill_tokens();
+
+        Item item;
+        while (m_queue.pop(item))
+        {
+            if (m_have_last && item.m_state == m_last.m_state && item.m_msg == m_last.m_msg)
+            {
+                ++m_repeats;
+                ++m_coalesced;
+                continue;
+            }
+
+            flush_repeats();
+            m_last = item;
+            m_have_last = true;
+            emit(item.m_state, item.m_msg);
+        }
+
+        send_pending();
+    }
+
+    // ===============================================================================================
+    void MotherPublisher::on_timer()
+    {
+        drain();
+
+        // A run of repeats is reported at least once a second even if it hasn't ended
+        flush_repeats();
+        m_have_last = false;
+
+        // Report what we had to throw away, these are not rate limited themselves
+        std::uint64_t dropped = m_dropped.load(boost::memory_order_relaxed);
+        if (dropped != m_dropped_reported)
+        {
+            std::stringstream ss;
+            ss << (dropped - m_dropped_reported) << " messages to mother were dropped, the publish queue was full";
+            emit(ERR_MSG, ss.str(), false);
+            m_dropped_reported = dropped;
+        }
+
+        if (m_throttled != m_throttled_reported && m_tokens >= 1)
+        {
+            std::stringstream ss;
+            ss << (m_throttled - m_throttled_reported) << " messages to mother were rate limited";
+            emit(ERR_MSG, ss.str(), false);
+            m_throttled_reported = m_throttled;
+        }
+
+        publish_mothers_heartbeat();
+        send_pending();
+
+        if (!m_stopped.load(boost::memory_order_relaxed))
+        {
+            m_timer.expires_at(m_timer.expires_at() + boost::posix_time::seconds(1));
+            m_timer.async_wait(boost::bind(&MotherPublisher::on_timer, this));
+        }
+    }
+
+    // ===============================================================================================
+    void MotherPublisher::refill_tokens()
+    {
+        boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+        double elapsed = (now - m_last_refill).total_microseconds() / 1000000.0;
+        m_last_refill = now;
+
+        // The burst is one second worth of messages
+        m_tokens = std::min(m_rate, m_tokens + elapsed * m_rate);
+    }
+
+    // ===============================================================================================
+    void MotherPublisher::flush_repeats()
+    {
+        if (m_repeats == 0)
+            return;
+
+        std::stringstream ss;
+        ss << " [repeated " << m_repeats << " times]";
+        std::string suffix = ss.str();
+
+        // Keep the suffix even if the original message filled the buffer
+        std::size_t length = std::min(m_last.m_msg.length(), m_last.m_msg.capacity() - suffix.size());
+        chaos::FixedString<SIZE_1024> text(m_last.m_msg.data(), length);
+        text.append(suffix.data(), suffix.size());
+
+        m_repeats = 0;
+        emit(m_last.m_state, text);
+    }
+
+    // ===============================================================================================
+    void MotherPublisher::emit(std::int32_t state, const chaos::FixedString<SIZE_1024>& msg, bool limited)
+    {
+        if (limited)
+        {
+            if (m_tokens < 1)
+            {
+                ++m_throttled;
+                return;
+            }
+            m_tokens -= 1;
+        }
+
+        if (m_batch_count == m_batch.size())
+            send_pending();
+
+        chaos::UDP_MSG& out = m_batch[m_batch_count++];
+        memcpy(&out, &m_log_msg, m_log_msg.header.m_length);
+        chaos::FixedString<sizeof(out.log.m_severity)>(get_state(state)).copy_to(out.log.m_severity);
+        msg.copy_to(out.log.m_log_message);
+    }
+
+    // ===============================================================================================
+    void MotherPublisher::send_pending()
+    {
+        if (m_batch_count == 0 || !m_mother)
+            return;
+
+        try
+        {
+            m_mother->send_batch(&m_batch[0], m_batch_count);
+        }
+        catch (...)
+        {
+            // Mother is best effort, a failed send must not take the publisher down
+        }
+        m_batch_count = 0;
+    }
+
+    // ===============================================================================================
+    void MotherPublisher::publish_mothers_heartbeat()
+    {
+        // Send the ping every 5 seconds
+        if (++m_heartbeat_counter % 5 != 0)
+            return;
+
+        // The version can update while the application is running so we need to update this as well,
+        // the snapshot is read without locking and is the same size as the wire field
+        chaos::ApplicationSnapshot snapshot;
+        chaos::ApplicationDetails::instance()->get_snapshot(snapshot);
+        snapshot.m_version.copy_to(m_mother_msg.mother.m_version);
+
+        if (m_batch_count == m_batch.size())
+            send_pending();
+        memcpy(&m_batch[m_batch_count++], &m_mother_msg, m_mother_msg.header.m_length);
+    }
+
+    // ===============================================================================================
+} // End of namespace
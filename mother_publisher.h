@@ -0,0 +1,103 @@
+// Publishes log events and heartbeats to mother from its own thread
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include "udp_messages.h"
+#include "udp.h"
+#include "fixed_string.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/thread/thread.hpp>
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    // The logger thread hands FAT, ERR and PUB messages over through a bounded queue and goes back
+    // to writing the file, the network is only ever touched from the publisher's own thread. On
+    // that thread the messages are
+    //
+    //      coalesced   - a message identical to the one before it is counted, not sent, and a
+    //                    single "[repeated N times]" copy goes out when the run ends or once a second
+    //      rate limited - a token bucket, anything over the limit is counted and reported later
+    //      batched     - everything that is ready goes out in one sendmmsg call
+    //
+    // When the queue is full new messages are dropped and counted, a flood of errors can never
+    // block or slow down the file logging. The counts are reported to mother once tokens allow.
+    //
+    // Tuned from the environment, CHAOS_MOTHER_RATE (messages a second, default 50) and
+    // CHAOS_MOTHER_QUEUE (queue size, default 4096).
+    class MotherPublisher
+    {
+    public:
+        MotherPublisher(const std::string& application_name);
+        virtual ~MotherPublisher();
+
+        // Called from the logger thread only, the queue has a single producer
+        void publish(std::int32_t state, const std::string& msg);
+
+        // Called by the producer after a batch of publish() calls to wake the publisher thread
+        void notify();
+
+        // Sends whatever is queued and stops the thread, the destructor calls this
+        void stop();
+
+        std::uint64_t get_dropped() { return m_dropped.load(boost::memory_order_relaxed); }
+        std::uint64_t get_throttled() { return m_throttled; }
+        std::uint64_t get_coalesced() { return m_coalesced; }
+
+    private:
+        struct Item
+        {
+            std::int32_t                    m_state;
+            chaos::FixedString<SIZE_1024>   m_msg;
+        };
+
+        void publisher_thread();
+        void drain();
+        void on_timer();
+        void refill_tokens();
+        void flush_repeats();
+        void emit(std::int32_t state, const chaos::FixedString<SIZE_1024>& msg, bool limited = true);
+        void send_pending();
+        void publish_mothers_heartbeat();
+
+        boost::asio::io_service                 m_io;
+        boost::asio::deadline_timer             m_timer;
+        boost::thread*                          m_thread;
+        chaos::Udp*                             m_mother;
+        boost::lockfree::spsc_queue<Item>       m_queue;
+        bool                                    m_queued;       // Producer side only
+        boost::atomic<bool>                     m_notified;
+        boost::atomic<std::uint64_t>            m_dropped;
+        boost::atomic<bool>                     m_stopped;
+
+        // Only touched by the publisher thread
+        chaos::UDP_MSG                          m_mother_msg;
+        chaos::UDP_MSG                          m_log_msg;
+        std::vector<chaos::UDP_MSG>             m_batch;
+        std::size_t                             m_batch_count;
+        Item                                    m_last;
+        bool                                    m_have_last;
+        std::uint64_t                           m_repeats;
+        double                                  m_rate;
+        double                                  m_tokens;
+        boost::posix_time::ptime                m_last_refill;
+        std::uint64_t                           m_throttled;
+        std::uint64_t                           m_throttled_reported;
+        std::uint64_t                           m_dropped_reported;
+        std::uint64_t                           m_coalesced;
+        std::int32_t                            m_heartbeat_counter;
+
+    };
+} // End of namespace
@@ -0,0 +1,313 @@
+// Thread local slab allocator for objects that are created on one thread and deleted on another
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include "spin_lock.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <boost/atomic.hpp>
+
+// =============================================================================================
+namespace chaos
+{
+    // =========================================================================================
+    // Fixed size blocks carved out of slabs. Every thread allocates from its own free list and
+    // every block remembers the thread that owns it. A block freed by its owner goes straight
+    // back on the free list, a block freed by another thread (the usual case for queue messages)
+    // is collected into a batch per owner and the whole batch is handed back with a single
+    // compare and swap. The owner picks the returned blocks up when its own list runs dry.
+    //
+    // Slabs are never released to the system, the pool grows to the peak number of live
+    // objects and stays there. When a thread exits its free list is parked and adopted by the
+    // next thread that starts allocating.
+    template<std::size_t Size>
+    class SlabAllocator
+    {
+    private:
+        struct Owner;
+
+        // Sits in front of every block, 16 bytes so the payload keeps malloc's alignment
+        struct Header
+        {
+            Owner*  m_owner;
+            Header* m_next;
+        };
+
+        struct Owner
+        {
+            boost::atomic<Header*>  m_remote;
+            Header*                 m_parked;
+
+            Owner() : m_remote(0), m_parked(0) {}
+        };
+
+        struct Pending
+        {
+            Owner*          m_owner;
+            Header*         m_head;
+            Header*         m_tail;
+            std::uint32_t   m_count;
+        };
+
+        enum
+        {
+            BlockSize = sizeof(Header) + ((Size + 15) & ~static_cast<std::size_t>(15)),
+            SlabBlocks = 64,
+            BatchSize = 32,
+            PendingSlots = 8
+        };
+
+        struct ThreadCache
+        {
+            Owner*          m_owner;
+            Header*         m_free;
+            std::uint32_t   m_victim;
+            Pending         m_pending[PendingSlots];
+
+            ThreadCache() : m_owner(adopt_owner()), m_free(m_owner->m_parked), m_victim(0)
+            {
+                m_owner->m_parked = 0;
+                for (std::uint32_t i = 0; i < PendingSlots; ++i)
+                {
+                    m_pending[i].m_owner = 0;
+                    m_pending[i].m_head = m_pending[i].m_tail = 0;
+                    m_pending[i].m_count = 0;
+                }
+            }
+
+            ~ThreadCache()
+            {
+                for (std::uint32_t i = 0; i < PendingSlots; ++i)
+                    hand_back(m_pending[i]);
+
+                // Park the free list so the next thread can reuse the blocks
+                m_owner->m_parked = m_free;
+                park_owner(m_owner);
+            }
+        };
+
+        // Owns the heap allocated cache so deletes that happen during thread exit still work
+        struct CacheHolder
+        {
+            ThreadCache* m_cache;
+
+            CacheHolder() : m_cache(new ThreadCache()) {}
+            ~CacheHolder()
+            {
+                ThreadCache* cache = m_cache;
+                m_cache = 0;
+                delete cache;
+            }
+        };
+
+    public:
+        static void* allocate()
+        {
+            ThreadCache* cache = get_cache();
+            if (!cache)
+                return allocate_orphan();
+
+            Header* h = cache->m_free;
+            if (!h)
+            {
+                // Take back everything the other threads have returned before growing
+                h = cache->m_owner->m_remote.exchange(0, boost::memory_order_acquire);
+                if (!h)
+                    h = allocate_slab(cache->m_owner);
+            }
+
+            cache->m_free = h->m_next;
+            return h + 1;
+        }
+
+        static void deallocate(void* p)
+        {
+            if (!p)
+                return;
+
+            Header* h = static_cast<Header*>(p) - 1;
+            ThreadCache* cache = get_cache();
+            if (cache && h->m_owner == cache->m_owner)
+            {
+                h->m_next = cache->m_free;
+                cache->m_free = h;
+                return;
+            }
+
+            if (!cache)
+            {
+                // The thread is exiting so return the block on its own
+                Pending single = { h->m_owner, h, h, 1 };
+                hand_back(single);
+                return;
+            }
+
+            Pending& pending = find_pending(cache, h->m_owner);
+            h->m_next = pending.m_head;
+            pending.m_head = h;
+            if (!pending.m_tail)
+                pending.m_tail = h;
+            if (++pending.m_count >= BatchSize)
+                hand_back(pending);
+        }
+
+        // Hands any partial batches held by the calling thread back to their owners
+        static void flush()
+        {
+            ThreadCache* cache = get_cache();
+            if (cache)
+            {
+                for (std::uint32_t i = 0; i < PendingSlots; ++i)
+                    hand_back(cache->m_pending[i]);
+            }
+        }
+
+    private:
+        static ThreadCache* get_cache()
+        {
+            static thread_local CacheHolder holder;
+            return holder.m_cache;
+        }
+
+        static Pending& find_pending(ThreadCache* cache, Owner* owner)
+        {
+            Pending* empty = 0;
+            for (std::uint32_t i = 0; i < PendingSlots; ++i)
+            {
+                Pending& pending = cache->m_pending[i];
+                if (pending.m_owner == owner)
+                    return pending;
+                if (!empty && pending.m_count == 0)
+                    empty = &pending;
+            }
+
+            // Every slot is busy with another owner so send one of them home early
+            if (!empty)
+            {
+                empty = &cache->m_pending[cache->m_victim++ % PendingSlots];
+                hand_back(*empty);
+            }
+
+            empty->m_owner = owner;
+            empty->m_head = empty->m_tail = 0;
+            empty->m_count = 0;
+            return *empty;
+        }
+
+        static void hand_back(Pending& pending)
+        {
+            if (pending.m_count == 0)
+                return;
+
+            Owner* owner = pending.m_owner;
+            Header* head = owner->m_remote.load(boost::memory_order_relaxed);
+            do
+            {
+                pending.m_tail->m_next = head;
+            } while (!owner->m_remote.compare_exchange_weak(head, pending.m_head, boost::memory_order_release, boost::memory_order_relaxed));
+
+            pending.m_head = pending.m_tail = 0;
+            pending.m_count = 0;
+        }
+
+        static Header* allocate_slab(Owner* owner)
+        {
+            char* slab = static_cast<char*>(malloc(BlockSize * SlabBlocks));
+            if (!slab)
+                throw std::bad_alloc();
+
+            Header* first = 0;
+            for (std::size_t i = SlabBlocks; i > 0; --i)
+            {
+                Header* h = reinterpret_cast<Header*>(slab + (i - 1) * BlockSize);
+                h->m_owner = owner;
+                h->m_next = first;
+                first = h;
+            }
+            return first;
+        }
+
+        static void* allocate_orphan()
+        {
+            // Only reached while the thread is being torn down, the rest of the slab is parked
+            Owner* owner = adopt_owner();
+            Header* h = owner->m_parked;
+            if (!h)
+                h = owner->m_remote.exchange(0, boost::memory_order_acquire);
+            if (!h)
+                h = allocate_slab(owner);
+            owner->m_parked = h->m_next;
+            park_owner(owner);
+            return h + 1;
+        }
+
+        static SpinLock& get_orphan_lock()
+        {
+            static SpinLock lock;
+            return lock;
+        }
+
+        static std::vector<Owner*>& get_orphans()
+        {
+            static std::vector<Owner*>* orphans = new std::vector<Owner*>();
+            return *orphans;
+        }
+
+        static Owner* adopt_owner()
+        {
+            Owner* owner = 0;
+            get_orphan_lock().lock();
+            if (!get_orphans().empty())
+            {
+                owner = get_orphans().back();
+                get_orphans().pop_back();
+            }
+            get_orphan_lock().unlock();
+
+            return owner ? owner : new Owner();
+        }
+
+        static void park_owner(Owner* owner)
+        {
+            get_orphan_lock().lock();
+            get_orphans().push_back(owner);
+            get_orphan_lock().unlock();
+        }
+
+    };
+
+    // =========================================================================================
+    // Derive from this to have new and delete of T go through the slab allocator, the class
+    // and clone() don't need to change. Subclasses larger than T fall back to the global heap.
+    template<typename T>
+    class Pooled
+    {
+    public:
+        static void* operator new(std::size_t size)
+        {
+            if (size <= sizeof(T))
+                return SlabAllocator<sizeof(T)>::allocate();
+            return ::operator new(size);
+        }
+
+        static void operator delete(void* p, std::size_t size)
+        {
+            if (size <= sizeof(T))
+                SlabAllocator<sizeof(T)>::deallocate(p);
+            else
+                ::operator delete(p);
+        }
+
+        static void flush_pool()
+        {
+            SlabAllocator<sizeof(T)>::flush();
+        }
+
+    };
+}
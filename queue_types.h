@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 // =============================================================================================
@@ -13,8 +14,10 @@ namespace chaos
     enum QueueType
     {
         QT_Unknown = 0,
-        QT_Logger
+        QT_Logger,
 
+        // Must stay last, it sizes the dispatch tables
+        QT_Max
     };
 
     // ===========================================================================
@@ -35,4 +38,61 @@ namespace chaos
         std::uint32_t m_type;
 
     };
-}
\ No newline at end of file
+
+    // ===========================================================================
+    // Routes queue messages to member functions of Owner with a table indexed by the queue type,
+    // there is no switch to edit and no dynamic_cast. A message type opts in by declaring
+    //
+    //      static const chaos::QueueType QUEUE_TYPE = chaos::QT_...;
+    //
+    // and passing it to set_type(), the owner then registers a handler for it once
+    //
+    //      m_dispatcher.register_handler<LogMessage, &Logger::write_log_message>();
+    //
+    // dispatch() takes ownership of the message and deletes it as its concrete type once the
+    // handler returns. Types without a handler are simply deleted.
+    template<class Owner>
+    class QueueDispatcher
+    {
+    public:
+        typedef void (*Handler)(Owner*, IQueue*);
+
+        QueueDispatcher(Owner* owner) : m_owner(owner)
+        {
+            for (std::uint32_t i = 0; i < QT_Max; ++i)
+                m_handlers[i] = &QueueDispatcher::unhandled;
+        }
+
+        template<class Msg, void (Owner::*Fn)(Msg&)>
+        void register_handler()
+        {
+            static_assert(Msg::QUEUE_TYPE > QT_Unknown && Msg::QUEUE_TYPE < QT_Max, "queue type out of range");
+            m_handlers[Msg::QUEUE_TYPE] = &QueueDispatcher::invoke<Msg, Fn>;
+        }
+
+        void dispatch(IQueue* msg)
+        {
+            std::uint32_t type = msg->get_type();
+            m_handlers[type < QT_Max ? type : static_cast<std::uint32_t>(QT_Unknown)](m_owner, msg);
+        }
+
+    private:
+        template<class Msg, void (Owner::*Fn)(Msg&)>
+        static void invoke(Owner* owner, IQueue* msg)
+        {
+            // The type tag guarantees what this is so a static_cast is enough
+            Msg* typed = static_cast<Msg*>(msg);
+            (owner->*Fn)(*typed);
+            delete typed;
+        }
+
+        static void unhandled(Owner*, IQueue* msg)
+        {
+            delete msg;
+        }
+
+        Owner*  m_owner;
+        Handler m_handlers[QT_Max];
+
+    };
+}
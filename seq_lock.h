@@ -0,0 +1,103 @@
+// Sequence lock for small structures that are read far more often than they are written
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include "spin_lock.h"
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include <boost/atomic.hpp>
+
+// =============================================================================================
+namespace chaos
+{
+    // =========================================================================================
+    // Readers never lock or allocate, they copy the value and retry if a writer was active
+    // while they were copying. Writers are serialized with a spin lock and bump the sequence
+    // to an odd number for the duration of the write. T has to be trivially copyable and
+    // should be small since a reader copies all of it.
+    template<typename T>
+    class SeqLock
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "SeqLock needs a trivially copyable type");
+
+    public:
+        SeqLock()
+            : m_seq(0)
+        {
+            // T only has to be trivially copyable, it can still have a default constructor
+            memset(static_cast<void*>(&m_data), 0, sizeof(T));
+        }
+
+        void load(T& value) const
+        {
+            for (;;)
+            {
+                std::uint32_t before = m_seq.load(boost::memory_order_acquire);
+                if (before & 1)
+                {
+                    // A write is in progress
+                    cpu_relax();
+                    continue;
+                }
+
+                memcpy(&value, &m_data, sizeof(T));
+                boost::atomic_thread_fence(boost::memory_order_acquire);
+
+                if (m_seq.load(boost::memory_order_relaxed) == before)
+                    return;
+            }
+        }
+
+        T load() const
+        {
+            T value;
+            load(value);
+            return value;
+        }
+
+        void store(const T& value)
+        {
+            m_write_lock.lock();
+            begin_write();
+            memcpy(&m_data, &value, sizeof(T));
+            end_write();
+            m_write_lock.unlock();
+        }
+
+        // Read-modify-write of the protected value, f is called with a reference to a copy
+        template<typename F>
+        void update(F f)
+        {
+            m_write_lock.lock();
+            T value;
+            memcpy(&value, &m_data, sizeof(T));
+            f(value);
+            begin_write();
+            memcpy(&m_data, &value, sizeof(T));
+            end_write();
+            m_write_lock.unlock();
+        }
+
+    private:
+        void begin_write()
+        {
+            m_seq.store(m_seq.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+            boost::atomic_thread_fence(boost::memory_order_release);
+        }
+
+        void end_write()
+        {
+            m_seq.store(m_seq.load(boost::memory_order_relaxed) + 1, boost::memory_order_release);
+        }
+
+        boost::atomic<std::uint32_t>    m_seq;
+        T                               m_data;
+        SpinLock                        m_write_lock;
+
+    };
+}
@@ -0,0 +1,295 @@
+// Shared memory ring for passing UDP_MSG framed messages between processes on the same host
+//
+// Copyright HOLM, 2023
+
+#include "pch.h"
+#include "shm_ring.h"
+
+#include <cstring>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The header and slot sequences are shared between processes, that only works if they are lock free
+static_assert(BOOST_ATOMIC_INT64_LOCK_FREE == 2, "shm_ring needs lock free 64 bit atomics");
+static_assert(BOOST_ATOMIC_INT32_LOCK_FREE == 2, "shm_ring needs lock free 32 bit atomics");
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    namespace shm_ring
+    {
+        static std::string shm_name(const std::string& name)
+        {
+            return (!name.empty() && name[0] == '/') ? name : "/chaos_" + name;
+        }
+
+        static std::size_t ring_size(std::uint32_t capacity)
+        {
+            return sizeof(Header) + static_cast<std::size_t>(capacity) * sizeof(Slot);
+        }
+    }
+
+    // ===============================================================================================
+    ShmPublisher::ShmPublisher(const std::string& name, std::uint32_t capacity, bool use_memfd) :
+        m_name(shm_ring::shm_name(name)),
+        m_use_memfd(use_memfd),
+        m_fd(-1),
+        m_size(0),
+        m_header(NULL),
+        m_slots(NULL),
+        m_mask(0),
+        m_next_seq(0)
+    {
+#ifndef WIN32
+        std::uint32_t slots = 2;
+        while (slots < capacity)
+            slots <<= 1;
+
+        if (use_memfd)
+            m_fd = memfd_create(m_name.c_str() + 1, MFD_CLOEXEC);
+        else
+            m_fd = shm_open(m_name.c_str(), O_CREAT | O_RDWR, 0600);
+
+        if (m_fd < 0)
+            return;
+
+        m_size = shm_ring::ring_size(slots);
+        if (ftruncate(m_fd, m_size) != 0)
+            return;
+
+        void* p = mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (p == MAP_FAILED)
+            return;
+
+        // Start from a clean ring. The name is only still there if the last publisher died
+        // without unlinking it, a subscriber left on that ring sees the magic vanish as closed.
+        memset(p, 0, m_size);
+
+        m_slots = reinterpret_cast<shm_ring::Slot*>(static_cast<char*>(p) + sizeof(shm_ring::Header));
+        m_mask = slots - 1;
+
+        shm_ring::Header* header = static_cast<shm_ring::Header*>(p);
+        header->m_version = shm_ring::VERSION;
+        header->m_capacity = slots;
+        header->m_slot_size = sizeof(shm_ring::Slot);
+        header->m_write_seq.store(0, boost::memory_order_relaxed);
+        header->m_subscribers.store(0, boost::memory_order_relaxed);
+
+        // The magic goes in last, a subscriber attaching while we set up just sees no ring yet
+        boost::atomic_thread_fence(boost::memory_order_release);
+        header->m_magic = shm_ring::MAGIC;
+        m_header = header;
+#endif
+    }
+
+    // ===============================================================================================
+    ShmPublisher::~ShmPublisher()
+    {
+#ifndef WIN32
+        // The subscribers keep the mapping after we unlink it, without the magic they know to
+        // stop polling it
+        if (m_header)
+        {
+            boost::atomic_thread_fence(boost::memory_order_release);
+            m_header->m_magic = 0;
+            munmap(m_header, m_size);
+        }
+        if (m_fd >= 0)
+            close(m_fd);
+        if (!m_use_memfd)
+            shm_unlink(m_name.c_str());
+#endif
+    }
+
+    // ===============================================================================================
+    std::int32_t ShmPublisher::get_subscriber_count()
+    {
+        return m_header ? m_header->m_subscribers.load(boost::memory_order_relaxed) : 0;
+    }
+
+    // ===============================================================================================
+    void ShmPublisher::send_msg(UDP_MSG& msg)
+    {
+        if (!m_header)
+            return;
+
+        std::uint64_t seq = m_next_seq++;
+        shm_ring::Slot& slot = m_slots[seq & m_mask];
+
+        std::size_t length = static_cast<std::size_t>(msg.header.m_length);
+        if (length < sizeof(MSG_HEADER) || length > sizeof(UDP_MSG))
+            length = sizeof(UDP_MSG);
+
+        // Odd while the copy is in progress, the fence keeps the payload stores behind it
+        slot.m_seq.store(seq * 2 + 1, boost::memory_order_relaxed);
+        boost::atomic_thread_fence(boost::memory_order_release);
+
+        memcpy(&slot.m_msg, &msg, length);
+        slot.m_msg.header.m_seq = static_cast<int>(seq);
+
+        slot.m_seq.store(seq * 2 + 2, boost::memory_order_release);
+        m_header->m_write_seq.store(seq + 1, boost::memory_order_release);
+    }
+
+    // ===============================================================================================
+    ShmSubscriber::ShmSubscriber(const std::string& name) :
+        m_name(shm_ring::shm_name(name)),
+        m_fd(-1),
+        m_own_fd(true),
+        m_size(0),
+        m_header(NULL),
+        m_slots(NULL),
+        m_mask(0),
+        m_cursor(0),
+        m_dropped(0)
+    {
+    }
+
+    // ===============================================================================================
+    ShmSubscriber::ShmSubscriber(int fd) :
+        m_fd(fd),
+        m_own_fd(false),
+        m_size(0),
+        m_header(NULL),
+        m_slots(NULL),
+        m_mask(0),
+        m_cursor(0),
+        m_dropped(0)
+    {
+    }
+
+    // ===============================================================================================
+    ShmSubscriber::~ShmSubscriber()
+    {
+        detach();
+    }
+
+    // ===============================================================================================
+    bool ShmSubscriber::attach()
+    {
+        if (m_header)
+            return true;
+
+#ifndef WIN32
+        if (m_own_fd)
+            m_fd = shm_open(m_name.c_str(), O_RDWR, 0);
+        if (m_fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(m_fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(shm_ring::Header))
+        {
+            detach();
+            return false;
+        }
+
+        m_size = static_cast<std::size_t>(st.st_size);
+        void* p = mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (p == MAP_FAILED)
+        {
+            detach();
+            return false;
+        }
+
+        shm_ring::Header* header = static_cast<shm_ring::Header*>(p);
+        bool valid = header->m_magic == shm_ring::MAGIC;
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        valid = valid && header->m_version == shm_ring::VERSION && header->m_slot_size == sizeof(shm_ring::Slot) &&
+                m_size >= shm_ring::ring_size(header->m_capacity);
+        if (!valid)
+        {
+            munmap(p, m_size);
+            detach();
+            return false;
+        }
+
+        m_header = header;
+        m_slots = reinterpret_cast<shm_ring::Slot*>(static_cast<char*>(p) + sizeof(shm_ring::Header));
+        m_mask = header->m_capacity - 1;
+        m_cursor = header->m_write_seq.load(boost::memory_order_acquire);
+        m_header->m_subscribers.fetch_add(1, boost::memory_order_relaxed);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // ===============================================================================================
+    void ShmSubscriber::detach()
+    {
+#ifndef WIN32
+        if (m_header)
+        {
+            m_header->m_subscribers.fetch_sub(1, boost::memory_order_relaxed);
+            munmap(m_header, m_size);
+            m_header = NULL;
+            m_slots = NULL;
+        }
+        // A descriptor handed to us stays with the caller so we can attach again
+        if (m_own_fd && m_fd >= 0)
+        {
+            close(m_fd);
+            m_fd = -1;
+        }
+#endif
+    }
+
+    // ===============================================================================================
+    shm_ring::PollResult ShmSubscriber::poll(UDP_MSG& msg)
+    {
+        if (!m_header)
+            return shm_ring::PR_Empty;
+
+        shm_ring::Slot& slot = m_slots[m_cursor & m_mask];
+        std::uint64_t expected = m_cursor * 2 + 2;
+        std::uint64_t before = slot.m_seq.load(boost::memory_order_acquire);
+        if (before < expected)
+        {
+            // Not written yet, unless the publisher has gone or restarted underneath us
+            std::uint64_t write_seq = m_header->m_write_seq.load(boost::memory_order_relaxed);
+            if (m_header->m_magic != shm_ring::MAGIC)
+            {
+                detach();
+                return shm_ring::PR_Closed;
+            }
+            if (write_seq >= m_cursor)
+                return shm_ring::PR_Empty;
+
+            m_cursor = write_seq;
+            return shm_ring::PR_Overrun;
+        }
+
+        if (before == expected)
+        {
+            memcpy(&msg.header, &slot.m_msg.header, sizeof(MSG_HEADER));
+            std::size_t length = static_cast<std::size_t>(msg.header.m_length);
+            if (length > sizeof(MSG_HEADER) && length <= sizeof(UDP_MSG))
+                memcpy(reinterpret_cast<char*>(&msg) + sizeof(MSG_HEADER), reinterpret_cast<char*>(&slot.m_msg) + sizeof(MSG_HEADER),
+                       length - sizeof(MSG_HEADER));
+
+            // If the sequence moved while we copied the publisher lapped us mid copy
+            boost::atomic_thread_fence(boost::memory_order_acquire);
+            if (slot.m_seq.load(boost::memory_order_relaxed) == before)
+            {
+                ++m_cursor;
+                return shm_ring::PR_Message;
+            }
+        }
+
+        // Lapped, skip to the oldest message that is still safe to read
+        std::uint64_t write_seq = m_header->m_write_seq.load(boost::memory_order_acquire);
+        std::uint64_t resume = (write_seq > m_mask) ? write_seq - m_mask : 0;
+        if (resume > m_cursor)
+            m_dropped += resume - m_cursor;
+        m_cursor = resume;
+        return shm_ring::PR_Overrun;
+    }
+
+    // ===============================================================================================
+} // End of namespace
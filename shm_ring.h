@@ -0,0 +1,117 @@
+// Shared memory ring for passing UDP_MSG framed messages between processes on the same host
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include "udp_messages.h"
+
+#include <cstdint>
+#include <string>
+
+#include <boost/atomic.hpp>
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    // Single publisher, many subscribers. The publisher never waits for anybody, every
+    // subscriber keeps its own cursor and a subscriber that falls more than a ring behind is
+    // told it was overrun and skips ahead. Each slot carries a sequence that is odd while the
+    // slot is being written so a reader can tell a torn copy and throw it away.
+    //
+    // The ring lives in /dev/shm (shm_open) under a name, or in an anonymous memfd whose
+    // descriptor is handed to the subscribers. Subscribers can attach and detach at any time,
+    // a new subscriber starts with the next message published. A publisher that shuts down
+    // clears the magic so its subscribers hear about it, a new publisher under the same name
+    // is a new ring and they have to attach again.
+    namespace shm_ring
+    {
+        static const std::uint64_t  MAGIC = 0x43484f5352494e47ULL;   // CHOSRING
+        static const std::uint32_t  VERSION = 1;
+
+        struct Header
+        {
+            std::uint64_t                   m_magic;
+            std::uint32_t                   m_version;
+            std::uint32_t                   m_capacity;
+            std::uint32_t                   m_slot_size;
+            alignas(64) boost::atomic<std::uint64_t>    m_write_seq;
+            alignas(64) boost::atomic<std::int32_t>     m_subscribers;
+        };
+
+        struct alignas(64) Slot
+        {
+            boost::atomic<std::uint64_t>    m_seq;
+            UDP_MSG                         m_msg;
+        };
+
+        enum PollResult
+        {
+            PR_Empty = 0,
+            PR_Message,
+            PR_Overrun,
+            PR_Closed
+        };
+    }
+
+    // ===============================================================================================
+    class ShmPublisher
+    {
+    public:
+        // capacity is rounded up to a power of two, with use_memfd the name is only a label
+        ShmPublisher(const std::string& name, std::uint32_t capacity = 4096, bool use_memfd = false);
+        virtual ~ShmPublisher();
+
+        bool is_open() { return m_header != NULL; }
+        int get_fd() { return m_fd; }
+        std::uint64_t get_sequence() { return m_next_seq; }
+        std::int32_t get_subscriber_count();
+
+        // Copies header.m_length bytes into the next slot, header.m_seq is set to the ring sequence
+        void send_msg(UDP_MSG& msg);
+
+    private:
+        std::string         m_name;
+        bool                m_use_memfd;
+        int                 m_fd;
+        std::size_t         m_size;
+        shm_ring::Header*   m_header;
+        shm_ring::Slot*     m_slots;
+        std::uint64_t       m_mask;
+        std::uint64_t       m_next_seq;
+
+    };
+
+    // ===============================================================================================
+    class ShmSubscriber
+    {
+    public:
+        ShmSubscriber(const std::string& name);
+        ShmSubscriber(int fd);
+        virtual ~ShmSubscriber();
+
+        bool attach();
+        void detach();
+        bool is_attached() { return m_header != NULL; }
+        std::uint64_t get_dropped() { return m_dropped; }
+
+        // Non blocking, returns PR_Message with the message copied into msg, PR_Empty if nothing
+        // new has been published, PR_Overrun if the publisher lapped us and messages were lost or
+        // PR_Closed if the publisher has gone, we are detached by then and can attach() again
+        shm_ring::PollResult poll(UDP_MSG& msg);
+
+    private:
+        std::string         m_name;
+        int                 m_fd;
+        bool                m_own_fd;
+        std::size_t         m_size;
+        shm_ring::Header*   m_header;
+        shm_ring::Slot*     m_slots;
+        std::uint64_t       m_mask;
+        std::uint64_t       m_cursor;
+        std::uint64_t       m_dropped;
+
+    };
+
+} // End of namespace
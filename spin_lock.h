@@ -1,16 +1,43 @@
-// Simple spin lock implementation
+// Simple spin lock implementation along with a few other locks for contended paths
 //
 // Copyright HOLM, 2023
 
 #pragma once
 
+#include <cstdint>
+
 #include <boost/atomic.hpp>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#ifndef WIN32
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define CACHE_LINE_SIZE     64
+
 // =============================================================================================
 namespace chaos
 {
     // =========================================================================================
-    class SpinLock
+    // Tells the core we are in a spin loop, this frees up the pipeline for the hyperthread
+    // sibling and stops the memory order violation flush when the lock is released
+    static inline void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#endif
+    }
+
+    // =========================================================================================
+    // Test and test-and-set lock. Waiters spin on a plain load so the cache line stays shared
+    // until the lock is released and back off exponentially after every failed exchange so
+    // they don't all hammer the line at the same time.
+    class alignas(CACHE_LINE_SIZE) SpinLock
     {
     private:
         typedef enum { Locked, Unlocked } LockState;
@@ -21,9 +48,27 @@ namespace chaos
             : m_state(Unlocked)
         {}
 
+        bool try_lock()
+        {
+            return (m_state.load(boost::memory_order_relaxed) == Unlocked &&
+                    m_state.exchange(Locked, boost::memory_order_acquire) == Unlocked);
+        }
+
         void lock()
         {
-            while (m_state.exchange(Locked, boost::memory_order_acquire) == Locked) { /* busy-wait */ }
+            std::uint32_t backoff = 1;
+            while (m_state.exchange(Locked, boost::memory_order_acquire) == Locked)
+            {
+                // Every failed exchange backs off for twice as long as the last one
+                for (std::uint32_t i = 0; i < backoff; ++i)
+                    cpu_relax();
+                if (backoff < 1024)
+                    backoff <<= 1;
+
+                // busy-wait on a read only copy of the line
+                while (m_state.load(boost::memory_order_relaxed) == Locked)
+                    cpu_relax();
+            }
         }
 
         void unlock()
@@ -32,4 +77,192 @@ namespace chaos
         }
 
     };
-}
\ No newline at end of file
+
+    // =========================================================================================
+    // Fair ticket lock, the threads get the lock in the order they asked for it. Waiters back
+    // off in proportion to how far they are from the front of the queue.
+    class alignas(CACHE_LINE_SIZE) TicketLock
+    {
+    private:
+        boost::atomic<std::uint32_t> m_next;
+        boost::atomic<std::uint32_t> m_serving;
+
+    public:
+        TicketLock()
+            : m_next(0), m_serving(0)
+        {}
+
+        bool try_lock()
+        {
+            std::uint32_t serving = m_serving.load(boost::memory_order_relaxed);
+            std::uint32_t expected = serving;
+            return m_next.compare_exchange_strong(expected, serving + 1, boost::memory_order_acquire, boost::memory_order_relaxed);
+        }
+
+        void lock()
+        {
+            std::uint32_t ticket = m_next.fetch_add(1, boost::memory_order_relaxed);
+            for (;;)
+            {
+                std::uint32_t serving = m_serving.load(boost::memory_order_acquire);
+                if (serving == ticket)
+                    return;
+
+                for (std::uint32_t i = 0, n = (ticket - serving) * 32; i < n; ++i)
+                    cpu_relax();
+            }
+        }
+
+        void unlock()
+        {
+            m_serving.store(m_serving.load(boost::memory_order_relaxed) + 1, boost::memory_order_release);
+        }
+
+    };
+
+    // =========================================================================================
+    // MCS queue lock, every waiter spins on its own node so a release only touches the cache
+    // line of the next waiter. The node has to live until unlock() so the usual way to use it
+    // is through McsLock::Guard on the stack.
+    class alignas(CACHE_LINE_SIZE) McsLock
+    {
+    public:
+        struct alignas(CACHE_LINE_SIZE) Node
+        {
+            boost::atomic<Node*>    m_next;
+            boost::atomic<bool>     m_locked;
+
+            Node() : m_next(0), m_locked(false) {}
+        };
+
+        class Guard
+        {
+        public:
+            Guard(McsLock& lock) : m_lock(lock) { m_lock.lock(m_node); }
+            ~Guard() { m_lock.unlock(m_node); }
+
+        private:
+            McsLock&    m_lock;
+            Node        m_node;
+        };
+
+    private:
+        boost::atomic<Node*> m_tail;
+
+    public:
+        McsLock()
+            : m_tail(0)
+        {}
+
+        bool try_lock(Node& node)
+        {
+            node.m_next.store(0, boost::memory_order_relaxed);
+            Node* expected = 0;
+            return m_tail.compare_exchange_strong(expected, &node, boost::memory_order_acquire, boost::memory_order_relaxed);
+        }
+
+        void lock(Node& node)
+        {
+            node.m_next.store(0, boost::memory_order_relaxed);
+            node.m_locked.store(true, boost::memory_order_relaxed);
+
+            Node* prev = m_tail.exchange(&node, boost::memory_order_acq_rel);
+            if (prev)
+            {
+                // Queue up behind the previous owner and wait for it to hand over
+                prev->m_next.store(&node, boost::memory_order_release);
+                while (node.m_locked.load(boost::memory_order_acquire))
+                    cpu_relax();
+            }
+        }
+
+        void unlock(Node& node)
+        {
+            Node* next = node.m_next.load(boost::memory_order_acquire);
+            if (!next)
+            {
+                // Nobody is queued, try to swing the tail back to empty
+                Node* expected = &node;
+                if (m_tail.compare_exchange_strong(expected, 0, boost::memory_order_release, boost::memory_order_relaxed))
+                    return;
+
+                // Somebody is in the middle of queueing so wait for the link
+                while (!(next = node.m_next.load(boost::memory_order_acquire)))
+                    cpu_relax();
+            }
+            next->m_locked.store(false, boost::memory_order_release);
+        }
+
+    };
+
+    // =========================================================================================
+    // Spins for a short while and then sleeps in the kernel on a futex, for locks that can be
+    // held long enough that spinning would waste a core. This is the three state mutex from
+    // Ulrich Drepper's "Futexes Are Tricky", 0 unlocked, 1 locked, 2 locked with waiters.
+    class alignas(CACHE_LINE_SIZE) AdaptiveMutex
+    {
+    private:
+        boost::atomic<std::int32_t> m_state;
+        std::uint32_t               m_spin;
+
+        static_assert(sizeof(boost::atomic<std::int32_t>) == sizeof(std::int32_t), "futex needs a plain 32 bit word");
+
+    public:
+        AdaptiveMutex(std::uint32_t spin = 100)
+            : m_state(0), m_spin(spin)
+        {}
+
+        bool try_lock()
+        {
+            std::int32_t expected = 0;
+            return m_state.compare_exchange_strong(expected, 1, boost::memory_order_acquire, boost::memory_order_relaxed);
+        }
+
+        void lock()
+        {
+            for (std::uint32_t i = 0; i < m_spin; ++i)
+            {
+                if (m_state.load(boost::memory_order_relaxed) == 0 && try_lock())
+                    return;
+                cpu_relax();
+            }
+
+            // Mark the lock as contended and sleep until the owner wakes us
+            std::int32_t state = m_state.exchange(2, boost::memory_order_acquire);
+            while (state != 0)
+            {
+                futex_wait(2);
+                state = m_state.exchange(2, boost::memory_order_acquire);
+            }
+        }
+
+        void unlock()
+        {
+            if (m_state.exchange(0, boost::memory_order_release) == 2)
+                futex_wake(1);
+        }
+
+    private:
+        std::int32_t* futex_address()
+        {
+            return reinterpret_cast<std::int32_t*>(&m_state);
+        }
+
+        void futex_wait(std::int32_t value)
+        {
+#ifndef WIN32
+            syscall(SYS_futex, futex_address(), FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+            cpu_relax();
+#endif
+        }
+
+        void futex_wake(std::int32_t count)
+        {
+#ifndef WIN32
+            syscall(SYS_futex, futex_address(), FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#endif
+        }
+
+    };
+}
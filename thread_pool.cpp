@@ -0,0 +1,267 @@
+// Work stealing thread pool with optional core pinning and real time priority
+//
+// Copyright HOLM, 2023
+
+#include "pch.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    namespace thread_pool
+    {
+        // Lets a task that submits more work push it onto its own worker's deque
+        thread_local ThreadPool*    current_pool = NULL;
+        thread_local std::size_t    current_index = 0;
+    }
+
+    // ===============================================================================================
+    ThreadPool::ThreadPool(std::size_t threads, const std::vector<std::int32_t>& cores, bool realtime, const std::string& name, std::uint32_t spin) :
+        m_cores(cores),
+        m_realtime(realtime),
+        m_name(name),
+        m_spin(spin),
+        m_next(0),
+        m_queued(0),
+        m_pending(0),
+        m_sleepers(0),
+        m_stop(false)
+    {
+        if (threads == 0)
+            threads = 1;
+
+        // All of the deques have to exist before any worker starts stealing
+        for (std::size_t i = 0; i < threads; ++i)
+            m_workers.push_back(new Worker());
+
+        for (std::size_t i = 0; i < threads; ++i)
+            m_workers[i]->m_thread = new boost::thread(&ThreadPool::worker_thread, this, i);
+    }
+
+    // ===============================================================================================
+    ThreadPool::~ThreadPool()
+    {
+        stop();
+
+        for (std::size_t i = 0; i < m_workers.size(); ++i)
+            delete m_workers[i];
+        m_workers.clear();
+    }
+
+    // ===============================================================================================
+    void ThreadPool::submit(const Task& task)
+    {
+        std::size_t index;
+        if (thread_pool::current_pool == this)
+            index = thread_pool::current_index;
+        else
+            index = m_next.fetch_add(1, boost::memory_order_relaxed) % m_workers.size();
+
+        m_pending.fetch_add(1, boost::memory_order_relaxed);
+        push(index, task);
+        wake(false);
+    }
+
+    // ===============================================================================================
+    void ThreadPool::submit_batch(std::vector<Task>& tasks)
+    {
+        if (tasks.empty())
+            return;
+
+        std::size_t workers = m_workers.size();
+        std::size_t chunk = (tasks.size() + workers - 1) / workers;
+        std::size_t first = m_next.fetch_add(1, boost::memory_order_relaxed);
+
+        m_pending.fetch_add(static_cast<std::int64_t>(tasks.size()), boost::memory_order_relaxed);
+        for (std::size_t begin = 0, w = 0; begin < tasks.size(); begin += chunk, ++w)
+        {
+            std::size_t end = std::min(begin + chunk, tasks.size());
+            Worker* worker = m_workers[(first + w) % workers];
+
+            worker->m_lock.lock();
+            for (std::size_t i = begin; i < end; ++i)
+                worker->m_tasks.push_back(std::move(tasks[i]));
+            worker->m_lock.unlock();
+
+            m_queued.fetch_add(static_cast<std::int64_t>(end - begin));
+        }
+        tasks.clear();
+
+        wake(true);
+    }
+
+    // ===============================================================================================
+    void ThreadPool::wait()
+    {
+        // Must not be called from one of the workers
+        while (m_pending.load(boost::memory_order_acquire) > 0)
+            boost::this_thread::yield();
+    }
+
+    // ===============================================================================================
+    void ThreadPool::stop()
+    {
+        if (m_stop.exchange(true))
+            return;
+
+        wake(true);
+
+        for (std::size_t i = 0; i < m_workers.size(); ++i)
+        {
+            if (m_workers[i]->m_thread)
+            {
+                m_workers[i]->m_thread->join();
+                delete m_workers[i]->m_thread;
+                m_workers[i]->m_thread = NULL;
+            }
+        }
+    }
+
+    // ===============================================================================================
+    void ThreadPool::worker_thread(std::size_t index)
+    {
+        thread_pool::current_pool = this;
+        thread_pool::current_index = index;
+
+        std::stringstream ss;
+        ss << m_name << "_" << index;
+        chaos::set_thread_name(ss.str());
+
+        if (!m_cores.empty())
+            chaos::pin_thread_to_core(m_cores[index % m_cores.size()]);
+        if (m_realtime)
+            chaos::set_thread_priority();
+
+        Task task;
+        std::uint32_t idle = 0;
+        for (;;)
+        {
+            if (pop_local(index, task) || steal(index, task))
+            {
+                run(task);
+                idle = 0;
+                continue;
+            }
+
+            // Nothing queued anywhere, only leave once everything queued has been run
+            if (m_stop.load(boost::memory_order_acquire) && m_queued.load() == 0)
+                break;
+
+            if (++idle < m_spin)
+            {
+                chaos::cpu_relax();
+                continue;
+            }
+
+            // Sleep until there is work. The sleeper count goes up before the final check and
+            // submitters read it after queueing, so one of the two always sees the other.
+            boost::unique_lock<boost::mutex> lock(m_sleep_mutex);
+            m_sleepers.fetch_add(1);
+            while (m_queued.load() == 0 && !m_stop.load())
+                m_sleep_cond.wait(lock);
+            m_sleepers.fetch_sub(1);
+            idle = 0;
+        }
+
+        thread_pool::current_pool = NULL;
+    }
+
+    // ===============================================================================================
+    bool ThreadPool::pop_local(std::size_t index, Task& task)
+    {
+        Worker* worker = m_workers[index];
+        if (m_queued.load(boost::memory_order_relaxed) == 0)
+            return false;
+
+        worker->m_lock.lock();
+        if (worker->m_tasks.empty())
+        {
+            worker->m_lock.unlock();
+            return false;
+        }
+        task = std::move(worker->m_tasks.back());
+        worker->m_tasks.pop_back();
+        worker->m_lock.unlock();
+
+        m_queued.fetch_sub(1);
+        return true;
+    }
+
+    // ===============================================================================================
+    bool ThreadPool::steal(std::size_t index, Task& task)
+    {
+        std::size_t workers = m_workers.size();
+        for (std::size_t i = 1; i < workers; ++i)
+        {
+            if (m_queued.load(boost::memory_order_relaxed) == 0)
+                return false;
+
+            // Take the oldest task from the victim, the owner works from the other end
+            Worker* victim = m_workers[(index + i) % workers];
+            if (!victim->m_lock.try_lock())
+                continue;
+
+            if (victim->m_tasks.empty())
+            {
+                victim->m_lock.unlock();
+                continue;
+            }
+            task = std::move(victim->m_tasks.front());
+            victim->m_tasks.pop_front();
+            victim->m_lock.unlock();
+
+            m_queued.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+
+    // ===============================================================================================
+    void ThreadPool::push(std::size_t index, const Task& task)
+    {
+        Worker* worker = m_workers[index];
+        worker->m_lock.lock();
+        worker->m_tasks.push_back(task);
+        worker->m_lock.unlock();
+
+        m_queued.fetch_add(1);
+    }
+
+    // ===============================================================================================
+    void ThreadPool::wake(bool all)
+    {
+        if (m_sleepers.load() == 0)
+            return;
+
+        // Taking the mutex makes sure a worker that is about to wait has already released it
+        boost::lock_guard<boost::mutex> lock(m_sleep_mutex);
+        if (all)
+            m_sleep_cond.notify_all();
+        else
+            m_sleep_cond.notify_one();
+    }
+
+    // ===============================================================================================
+    void ThreadPool::run(Task& task)
+    {
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            // A task that throws must not take the worker down with it
+        }
+
+        task.clear();
+        m_pending.fetch_sub(1, boost::memory_order_release);
+    }
+
+    // ===============================================================================================
+} // End of namespace
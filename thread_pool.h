@@ -0,0 +1,89 @@
+// Work stealing thread pool with optional core pinning and real time priority
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include "spin_lock.h"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    // Every worker owns a deque of tasks. A worker takes its own work from the back (most recent
+    // first, which is still warm in its cache) and when it runs dry it steals from the front of
+    // the other workers' deques. Tasks submitted from outside the pool are dealt round robin,
+    // tasks submitted from inside a worker go on that worker's own deque.
+    //
+    // Idle workers spin briefly before going to sleep on a condition variable, so a busy pool
+    // never touches the kernel to hand out work.
+    class ThreadPool
+    {
+    public:
+        typedef boost::function<void()> Task;
+
+        // cores can be empty, otherwise worker i is pinned to cores[i % cores.size()]. With
+        // realtime set every worker runs with SCHED_FIFO, see set_thread_priority().
+        ThreadPool(std::size_t threads, const std::vector<std::int32_t>& cores = std::vector<std::int32_t>(),
+                   bool realtime = false, const std::string& name = "Pool", std::uint32_t spin = 2000);
+        virtual ~ThreadPool();
+
+        std::size_t get_thread_count() { return m_workers.size(); }
+        std::int64_t get_pending() { return m_pending.load(boost::memory_order_relaxed); }
+
+        void submit(const Task& task);
+
+        // Hands the tasks out in one contiguous block per worker, one lock and one wake up per
+        // worker instead of one per task. The vector is left empty.
+        void submit_batch(std::vector<Task>& tasks);
+
+        // Blocks until every submitted task has finished running
+        void wait();
+
+        // Stops the workers once the tasks already queued have run
+        void stop();
+
+    private:
+        struct alignas(CACHE_LINE_SIZE) Worker
+        {
+            SpinLock            m_lock;
+            std::deque<Task>    m_tasks;
+            boost::thread*      m_thread;
+
+            Worker() : m_thread(NULL) {}
+        };
+
+        void worker_thread(std::size_t index);
+        bool pop_local(std::size_t index, Task& task);
+        bool steal(std::size_t index, Task& task);
+        void push(std::size_t index, const Task& task);
+        void wake(bool all);
+        void run(Task& task);
+
+        std::vector<Worker*>            m_workers;
+        std::vector<std::int32_t>       m_cores;
+        bool                            m_realtime;
+        std::string                     m_name;
+        std::uint32_t                   m_spin;
+
+        boost::atomic<std::size_t>      m_next;
+        boost::atomic<std::int64_t>     m_queued;
+        boost::atomic<std::int64_t>     m_pending;
+        boost::atomic<std::uint32_t>    m_sleepers;
+        boost::atomic<bool>             m_stop;
+        boost::mutex                    m_sleep_mutex;
+        boost::condition_variable       m_sleep_cond;
+
+    };
+} // End of namespace
@@ -6,7 +6,14 @@
 #include "pch.h"
 #include "udp.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
 
 #include <boost/bind/bind.hpp>
 
@@ -113,9 +120,39 @@ namespace chaos
     }
 
     // ========================================================================
-    void Udp::send_msg( UDP_MSG& msg )
+    std::size_t Udp::send_batch( UDP_MSG* msgs, std::size_t count )
     {
-        m_remote_socket.send_to( boost::asio::buffer((char*)&(msg), msg.header.m_length), m_remote_endpoint );
+#ifndef WIN32
+        const std::size_t MAX_BATCH = 64;
+        mmsghdr hdrs[MAX_BATCH];
+        iovec iov[MAX_BATCH];
+
+        std::size_t sent = 0;
+        while( sent < count )
+        {
+            std::size_t n = std::min( count - sent, MAX_BATCH );
+            memset( hdrs, 0, sizeof(mmsghdr) * n );
+            for( std::size_t i = 0; i < n; ++i )
+            {
+                iov[i].iov_base = &msgs[sent + i];
+                iov[i].iov_len = msgs[sent + i].header.m_length;
+                hdrs[i].msg_hdr.msg_name = m_remote_endpoint.data();
+                hdrs[i].msg_hdr.msg_namelen = m_remote_endpoint.size();
+                hdrs[i].msg_hdr.msg_iov = &iov[i];
+                hdrs[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            int rc = sendmmsg( m_remote_socket.native_handle(), hdrs, n, 0 );
+            if( rc <= 0 )
+                break;
+            sent += rc;
+        }
+        return sent;
+#else
+        for( std::size_t i = 0; i < count; ++i )
+            send_msg( msgs[i] );
+        return count;
+#endif
     }
 
     // ========================================================================
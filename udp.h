@@ -28,8 +28,18 @@ namespace chaos
 
         void start();
         void shutdown();
-        void send_msg( UDP_MSG& pMsg );
+
+        // Inline so a caller doesn't pay a call through the PLT on top of the system call
+        void send_msg( UDP_MSG& msg )
+        {
+            m_remote_socket.send_to( boost::asio::buffer((char*)&(msg), msg.header.m_length), m_remote_endpoint );
+        }
+
         void async_send_msg( UDP_MSG& pMsg );
+
+        // Sends count messages with as few system calls as possible (sendmmsg on linux), returns
+        // how many were handed to the kernel
+        std::size_t send_batch( UDP_MSG* msgs, std::size_t count );
         
     protected:
         virtual void on_message( const boost::system::error_code& error, size_t bytes_recvd );
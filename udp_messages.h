@@ -20,7 +20,15 @@ namespace chaos
         LOG,
         SDM_SNAPSHOT,
         SDM_EVENT,
-        SDM
+        SDM,
+        CONTROL
+    };
+
+    // Commands carried by a CONTROL message
+    enum ControlCommands
+    {
+        CC_UNDEFINED,
+        CC_SET_LOG_LEVEL
     };
 
     #define     SIZE_8        8
@@ -106,6 +114,19 @@ namespace chaos
 
     } MSG_MOTHER, *PMSG_MOTHER;
 
+    // ============================================================================================
+    // An empty application or instance addresses every application or instance
+    typedef struct _MSG_CONTROL
+    {
+        char  m_application[SIZE_80];
+        char  m_instance[SIZE_80];
+        int   m_command;
+        int   m_value;
+
+        inline int getLength() { return sizeof(MSG_HEADER)+sizeof(_MSG_CONTROL); }
+
+    } MSG_CONTROL, *PMSG_CONTROL;
+
     // ============================================================================================
     typedef struct _MSG_SDM
     {
@@ -122,6 +143,7 @@ namespace chaos
             MSG_LOG     log;
             MSG_MOTHER  mother;
             MSG_SDM     sdm;
+            MSG_CONTROL control;
         };
 
         inline void clear() 
@@ -0,0 +1,222 @@
+// Compact 64 bit unique ids for orders and messages
+//
+// Copyright HOLM, 2023
+
+#include "pch.h"
+#include "unique_id.h"
+#include "utils.h"
+#include "time_utils.h"
+#include "application_details.h"
+#include "logger.h"
+
+#include <cctype>
+#include <cstdlib>
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <boost/atomic.hpp>
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    namespace unique_id
+    {
+        static const std::uint32_t  SHARED_SLOT = (1U << UniqueId::SLOT_BITS) - 1;
+
+        // ===========================================================================================
+        // The TSC against the wall clock, measured once
+        struct Clock
+        {
+            std::uint64_t   m_base_tsc;
+            std::uint64_t   m_base_ms;
+            double          m_ms_per_tick;
+
+            Clock()
+            {
+                timespec start, end;
+                clock_gettime(CLOCK_REALTIME, &start);
+                std::uint64_t start_tsc = chaos::get_point_in_time();
+
+                // 10ms is enough for a rate good to a few parts per million
+                do
+                {
+                    clock_gettime(CLOCK_REALTIME, &end);
+                } while (to_ns(end) - to_ns(start) < 10000000ULL);
+                std::uint64_t end_tsc = chaos::get_point_in_time();
+
+                m_base_tsc = end_tsc;
+                m_base_ms = to_ns(end) / 1000000ULL - UniqueId::EPOCH_MS;
+                m_ms_per_tick = (end_tsc > start_tsc) ? (to_ns(end) - to_ns(start)) / 1000000.0 / (end_tsc - start_tsc) : 0.0;
+            }
+
+            static std::uint64_t to_ns(const timespec& ts)
+            {
+                return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+            }
+
+            std::uint64_t now_ms() const
+            {
+                if (m_ms_per_tick == 0.0)
+                {
+                    // No usable TSC, fall back to the system clock
+                    timespec ts;
+                    clock_gettime(CLOCK_REALTIME, &ts);
+                    return to_ns(ts) / 1000000ULL - UniqueId::EPOCH_MS;
+                }
+                // Another core's TSC can be a little behind the one we calibrated on
+                std::int64_t ticks = static_cast<std::int64_t>(chaos::get_point_in_time() - m_base_tsc);
+                return m_base_ms + static_cast<std::uint64_t>((ticks > 0 ? ticks : 0) * m_ms_per_tick);
+            }
+        };
+
+        // ===========================================================================================
+        static const Clock& clock()
+        {
+            static const Clock clock;
+            return clock;
+        }
+
+        boost::atomic<std::int32_t>     instance(-1);
+        boost::atomic<std::uint32_t>    next_slot(0);
+        boost::atomic<std::uint64_t>    shared_last(0);
+        boost::atomic<bool>             forked(false);
+
+        // The last (timestamp << SEQUENCE_BITS | sequence) this thread handed out
+        thread_local std::uint32_t      slot = SHARED_SLOT + 1;
+        thread_local std::uint64_t      last = 0;
+
+        // ===========================================================================================
+        // The child would carry on with the parent's instance, slots and sequences and hand out
+        // the same ids. Only the forking thread survives so its slot is the only one to reset,
+        // the instance is resolved again with the pid mixed in.
+        static void reset_after_fork()
+        {
+            instance.store(-1, boost::memory_order_relaxed);
+            next_slot.store(0, boost::memory_order_relaxed);
+            shared_last.store(0, boost::memory_order_relaxed);
+            forked.store(true, boost::memory_order_relaxed);
+            slot = SHARED_SLOT + 1;
+            last = 0;
+        }
+
+        // ===========================================================================================
+        // For a process that isn't a configured instance, the pid keeps it apart from the others
+        // on the same host
+        static std::uint32_t instance_with_pid(const std::string& name)
+        {
+            return UniqueId::instance_from_name(name + "#" + std::to_string(getpid()));
+        }
+    }
+
+    // ===============================================================================================
+    std::uint32_t UniqueId::instance_from_name(const std::string& name)
+    {
+        const std::uint32_t limit = 1U << INSTANCE_BITS;
+
+        std::size_t digits = name.size();
+        while (digits > 0 && isdigit(static_cast<unsigned char>(name[digits - 1])))
+            --digits;
+        if (digits < name.size() && name.size() - digits <= 4)
+        {
+            std::uint32_t number = static_cast<std::uint32_t>(atoi(name.c_str() + digits));
+            if (number < limit)
+                return number;
+        }
+
+        // FNV-1a folded down to the instance bits
+        std::uint32_t hash = 2166136261U;
+        for (std::size_t i = 0; i < name.size(); ++i)
+        {
+            hash ^= static_cast<unsigned char>(name[i]);
+            hash *= 16777619U;
+        }
+        return (hash ^ (hash >> INSTANCE_BITS) ^ (hash >> (2 * INSTANCE_BITS))) & (limit - 1);
+    }
+
+    // ===============================================================================================
+    void UniqueId::set_instance(std::uint32_t instance)
+    {
+        unique_id::instance.store(static_cast<std::int32_t>(instance & ((1U << INSTANCE_BITS) - 1)));
+    }
+
+    // ===============================================================================================
+    std::uint32_t UniqueId::get_instance()
+    {
+        std::int32_t instance = unique_id::instance.load(boost::memory_order_relaxed);
+        if (instance >= 0)
+            return static_cast<std::uint32_t>(instance);
+
+        // Registered once, before the first id
+        static const int at_fork = pthread_atfork(NULL, NULL, &unique_id::reset_after_fork);
+        (void)at_fork;
+
+        std::string name = chaos::ApplicationDetails::instance()->get_application_instance();
+        std::string value = chaos::get_environment_string("CHAOS_ID_INSTANCE");
+        bool forked = unique_id::forked.load(boost::memory_order_relaxed);
+        bool unset = value.empty() && name == "UNK";
+
+        std::uint32_t resolved;
+        if (forked || unset)
+            resolved = unique_id::instance_with_pid(name);
+        else if (value.empty())
+            resolved = instance_from_name(name);
+        else
+            resolved = static_cast<std::uint32_t>(atoi(value.c_str())) & ((1U << INSTANCE_BITS) - 1);
+
+        // Whoever gets there first wins so every thread uses the same instance
+        std::int32_t expected = -1;
+        if (unique_id::instance.compare_exchange_strong(expected, static_cast<std::int32_t>(resolved)) && unset && !forked)
+        {
+            std::stringstream ss;
+            ss << "No application instance or CHAOS_ID_INSTANCE, unique id instance " << resolved << " is from the pid and can collide";
+            LOG(WARN_MSG, ss.str());
+        }
+        return static_cast<std::uint32_t>(unique_id::instance.load());
+    }
+
+    // ===============================================================================================
+    std::uint64_t UniqueId::now_ms()
+    {
+        return unique_id::clock().now_ms();
+    }
+
+    // ===============================================================================================
+    std::uint64_t UniqueId::next()
+    {
+        if (unique_id::slot > unique_id::SHARED_SLOT)
+        {
+            std::uint32_t slot = unique_id::next_slot.fetch_add(1, boost::memory_order_relaxed);
+            unique_id::slot = (slot < unique_id::SHARED_SLOT) ? slot : unique_id::SHARED_SLOT;
+        }
+
+        // Never behind the clock and never behind the last id, which also moves us into the next
+        // millisecond once the sequence is used up
+        std::uint64_t now = unique_id::clock().now_ms() << SEQUENCE_BITS;
+        std::uint64_t stamp;
+        if (unique_id::slot != unique_id::SHARED_SLOT)
+        {
+            stamp = (now > unique_id::last) ? now : unique_id::last + 1;
+            unique_id::last = stamp;
+        }
+        else
+        {
+            std::uint64_t last = unique_id::shared_last.load(boost::memory_order_relaxed);
+            do
+            {
+                stamp = (now > last) ? now : last + 1;
+            } while (!unique_id::shared_last.compare_exchange_weak(last, stamp, boost::memory_order_relaxed));
+        }
+
+        std::uint64_t timestamp = stamp >> SEQUENCE_BITS;
+        std::uint64_t sequence = stamp & ((1U << SEQUENCE_BITS) - 1);
+        return (timestamp << (INSTANCE_BITS + SLOT_BITS + SEQUENCE_BITS)) |
+               (static_cast<std::uint64_t>(get_instance()) << (SLOT_BITS + SEQUENCE_BITS)) |
+               (static_cast<std::uint64_t>(unique_id::slot) << SEQUENCE_BITS) |
+               sequence;
+    }
+
+    // ===============================================================================================
+} // End of namespace
@@ -0,0 +1,63 @@
+// Compact 64 bit unique ids for orders and messages
+//
+// Copyright HOLM, 2023
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// ===================================================================================================
+namespace chaos
+{
+    // ===============================================================================================
+    // Snowflake style ids, from the most significant bit down
+    //
+    //      39 bits     milliseconds since 2023-01-01 UTC, good until 2040
+    //      10 bits     instance, unique per process across the estate
+    //       5 bits     thread slot, unique per thread within the process
+    //      10 bits     sequence within the millisecond
+    //
+    // The ids of one thread are strictly increasing and sort by time across threads and
+    // processes. The clock is the TSC, calibrated against CLOCK_REALTIME on first use, and it
+    // never goes backwards. A thread that uses up its 1024 ids in a millisecond carries on in
+    // the next millisecond rather than waiting, its timestamps run ahead of the clock until the
+    // burst is over.
+    //
+    // The first 31 threads to ask for an id get a slot of their own and no shared state at all,
+    // any thread after that shares the last slot through a single atomic.
+    //
+    // The instance comes from ApplicationDetails::get_application_instance(), the trailing
+    // number if it ends in one below 1024 (TRADER_12 is 12) and a hash of the name otherwise.
+    // Hashes can collide, deployments that need a guarantee number their instances or set
+    // CHAOS_ID_INSTANCE, or call set_instance() before the first id. Without either the
+    // instance is still the default UNK, it is hashed with the pid and a warning is logged.
+    //
+    // A forked child starts again with no slots taken and the instance hashed with its own
+    // pid, it can call set_instance() if it has one of its own.
+    class UniqueId
+    {
+    public:
+        static const std::uint32_t  TIMESTAMP_BITS = 39;
+        static const std::uint32_t  INSTANCE_BITS = 10;
+        static const std::uint32_t  SLOT_BITS = 5;
+        static const std::uint32_t  SEQUENCE_BITS = 10;
+        static const std::uint64_t  EPOCH_MS = 1672531200000ULL;
+
+        static std::uint64_t next();
+
+        static void set_instance(std::uint32_t instance);
+        static std::uint32_t get_instance();
+        static std::uint32_t instance_from_name(const std::string& name);
+
+        // Pulling an id apart again
+        static std::uint64_t get_unix_ms(std::uint64_t id) { return (id >> (INSTANCE_BITS + SLOT_BITS + SEQUENCE_BITS)) + EPOCH_MS; }
+        static std::uint32_t get_instance(std::uint64_t id) { return static_cast<std::uint32_t>(id >> (SLOT_BITS + SEQUENCE_BITS)) & ((1U << INSTANCE_BITS) - 1); }
+        static std::uint32_t get_slot(std::uint64_t id) { return static_cast<std::uint32_t>(id >> SEQUENCE_BITS) & ((1U << SLOT_BITS) - 1); }
+        static std::uint32_t get_sequence(std::uint64_t id) { return static_cast<std::uint32_t>(id) & ((1U << SEQUENCE_BITS) - 1); }
+
+        // Milliseconds since EPOCH_MS from the calibrated TSC
+        static std::uint64_t now_ms();
+
+    };
+} // End of namespace
@@ -9,6 +9,7 @@
 #include <cstdlib>
 
 #ifndef WIN32
+#include <sched.h>
 #include <sys/prctl.h>
 #include <unistd.h>
 #endif
@@ -29,7 +30,7 @@ namespace chaos
     static void sleep(int value)
     {
 #ifndef WIN32
-        sleep(value);
+        ::sleep(value);
 #endif
     }
 
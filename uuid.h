@@ -4,14 +4,211 @@
 
 #pragma once
 
+#include <cstdint>
 #include <cstring>
 #include <string>
 
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
 #include <uuid/uuid.h>
 
 // ========================================================================
 namespace chaos
 {
+    // ========================================================================
+    // Every thread has its own xoshiro256** generator seeded from the kernel once, after that a
+    // uuid costs a few multiplies and shifts with no system call, lock or daemon involved. The
+    // thread that calls fork() reseeds in the child so the two processes don't repeat each other.
+    namespace uuid
+    {
+        // ====================================================================
+        struct Xoshiro256
+        {
+            std::uint64_t   m_state[4];
+
+            Xoshiro256()
+            {
+                seed();
+            }
+
+            void seed()
+            {
+                if( getrandom( m_state, sizeof(m_state), 0 ) != sizeof(m_state) )
+                {
+                    // No entropy from the kernel, mix what is unique to this thread instead
+                    timespec ts;
+                    clock_gettime( CLOCK_MONOTONIC, &ts );
+                    std::uint64_t seed = (static_cast<std::uint64_t>(ts.tv_sec) << 30) ^ ts.tv_nsec ^
+                                         (static_cast<std::uint64_t>(getpid()) << 40) ^ reinterpret_cast<std::uintptr_t>(this);
+                    for( int i = 0; i < 4; ++i )
+                        m_state[i] = splitmix( seed );
+                }
+            }
+
+            static inline std::uint64_t splitmix( std::uint64_t& seed )
+            {
+                std::uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                return z ^ (z >> 31);
+            }
+
+            static inline std::uint64_t rotl( std::uint64_t x, int k )
+            {
+                return (x << k) | (x >> (64 - k));
+            }
+
+            inline std::uint64_t next()
+            {
+                std::uint64_t result = rotl( m_state[1] * 5, 7 ) * 9;
+                std::uint64_t t = m_state[1] << 17;
+                m_state[2] ^= m_state[0];
+                m_state[3] ^= m_state[1];
+                m_state[1] ^= m_state[2];
+                m_state[0] ^= m_state[3];
+                m_state[2] ^= t;
+                m_state[3] = rotl( m_state[3], 45 );
+                return result;
+            }
+        };
+
+        // ====================================================================
+        // The v7 state, the 12 bit rand_a field counts up within a millisecond so the ids from
+        // one thread are strictly increasing
+        struct V7State
+        {
+            std::uint64_t   m_last_ms;
+            std::uint32_t   m_counter;
+
+            V7State() : m_last_ms(0), m_counter(0) {}
+        };
+
+        // ====================================================================
+        static inline void reseed_after_fork();
+
+        static inline Xoshiro256& thread_rng()
+        {
+            // Registered once, only the forking thread survives in the child so it is the only
+            // state that needs a new seed
+            static const int at_fork = pthread_atfork( NULL, NULL, &reseed_after_fork );
+            (void)at_fork;
+
+            static thread_local Xoshiro256 rng;
+            return rng;
+        }
+
+        // ====================================================================
+        static inline V7State& thread_v7()
+        {
+            static thread_local V7State state;
+            return state;
+        }
+
+        // ====================================================================
+        static inline void reseed_after_fork()
+        {
+            thread_rng().seed();
+            thread_v7() = V7State();
+        }
+
+        // ====================================================================
+        static inline void store_be64( unsigned char* p, std::uint64_t v )
+        {
+            v = __builtin_bswap64( v );
+            memcpy( p, &v, sizeof(v) );
+        }
+
+        // ====================================================================
+        static const char HEX_PAIRS[] =
+            "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+            "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+            "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+            "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+            "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+            "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+            "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+            "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+    }
+
+    // ========================================================================
+    // The canonical lower case form, out must hold UUID_STRING_SIZE bytes and is null terminated
+    static const std::size_t UUID_STRING_SIZE = 37;
+
+    // ========================================================================
+    static inline void format_uuid( const uuid_t& id, char* out )
+    {
+        char hex[32];
+#ifdef __SSSE3__
+        // Split every byte into its two nibbles and look both up in one shuffle each
+        const __m128i digits = _mm_setr_epi8( '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' );
+        const __m128i mask = _mm_set1_epi8( 0x0f );
+        __m128i bytes = _mm_loadu_si128( reinterpret_cast<const __m128i*>(id) );
+        __m128i high = _mm_shuffle_epi8( digits, _mm_and_si128( _mm_srli_epi16( bytes, 4 ), mask ) );
+        __m128i low = _mm_shuffle_epi8( digits, _mm_and_si128( bytes, mask ) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>(hex), _mm_unpacklo_epi8( high, low ) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>(hex + 16), _mm_unpackhi_epi8( high, low ) );
+#else
+        for( int i = 0; i < 16; ++i )
+            memcpy( hex + i * 2, uuid::HEX_PAIRS + id[i] * 2, 2 );
+#endif
+        memcpy( out, hex, 8 );
+        out[8] = '-';
+        memcpy( out + 9, hex + 8, 4 );
+        out[13] = '-';
+        memcpy( out + 14, hex + 12, 4 );
+        out[18] = '-';
+        memcpy( out + 19, hex + 16, 4 );
+        out[23] = '-';
+        memcpy( out + 24, hex + 20, 12 );
+        out[36] = 0;
+    }
+
+    // ========================================================================
+    // Random, version 4
+    static inline void generate_uuid_v4( uuid_t& id )
+    {
+        uuid::Xoshiro256& rng = uuid::thread_rng();
+        uuid::store_be64( id, rng.next() );
+        uuid::store_be64( id + 8, rng.next() );
+        id[6] = static_cast<unsigned char>((id[6] & 0x0f) | 0x40);
+        id[8] = static_cast<unsigned char>((id[8] & 0x3f) | 0x80);
+    }
+
+    // ========================================================================
+    // Unix millisecond timestamp first so the ids sort by creation time, version 7
+    static inline void generate_uuid_v7( uuid_t& id )
+    {
+        timespec ts;
+        clock_gettime( CLOCK_REALTIME, &ts );
+        std::uint64_t ms = static_cast<std::uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+
+        uuid::Xoshiro256& rng = uuid::thread_rng();
+        uuid::V7State& state = uuid::thread_v7();
+        if( ms > state.m_last_ms )
+        {
+            // Start low in the counter so a busy millisecond has room to count up
+            state.m_last_ms = ms;
+            state.m_counter = static_cast<std::uint32_t>(rng.next() & 0x3ff);
+        }
+        else if( ++state.m_counter > 0xfff )
+        {
+            // Used up the millisecond (or the clock went back), borrow the next one
+            ++state.m_last_ms;
+            state.m_counter = 0;
+        }
+
+        uuid::store_be64( id, (state.m_last_ms << 16) | 0x7000 | state.m_counter );
+        uuid::store_be64( id + 8, rng.next() );
+        id[8] = static_cast<unsigned char>((id[8] & 0x3f) | 0x80);
+    }
+
     // ========================================================================
     static void generate_uuid( uuid_t& id )
     {
@@ -33,10 +230,9 @@ namespace chaos
     // ========================================================================
     static std::string convert_uuid_to_string( uuid_t& id )
     {
-        char uuid_str[37];
-        memset( uuid_str, 0, sizeof(uuid_str) );
-        uuid_unparse_lower( id, uuid_str );
-        return std::string( uuid_str );
+        char uuid_str[UUID_STRING_SIZE];
+        format_uuid( id, uuid_str );
+        return std::string( uuid_str, UUID_STRING_SIZE - 1 );
     }
 
     // ========================================================================
@@ -55,11 +251,20 @@ namespace chaos
     }
 
     // ========================================================================
+    // Time ordered like the uuid_generate_time_safe() ids it replaces, but generated in process
     static std::string generate_uuid_string()
     {
         uuid_t id;
-        uuid_generate_time_safe( id );
+        generate_uuid_v7( id );
         return convert_uuid_to_string( id );
     }
 
+    // ========================================================================
+    static void generate_uuid_string( char* out )
+    {
+        uuid_t id;
+        generate_uuid_v7( id );
+        format_uuid( id, out );
+    }
+
 }
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "queue_types.h"
+#include "object_pool.h"
 
 #include <boost/atomic.hpp>
 #include <boost/lockfree/queue.hpp>
@@ -17,7 +18,9 @@ namespace chaos
     class WaitFreeQueue
     {
     public:
-        struct node
+        // Nodes are pushed on the producer thread and deleted on the consumer thread so they
+        // come from the slab allocator rather than the global heap
+        struct node : public chaos::Pooled<node>
         {
             T data;
             node* next;
@@ -56,6 +59,12 @@ namespace chaos
             return m_head.exchange(0, boost::memory_order_consume);
         }
 
+        // The newest node without taking anything, for the crash handler to walk
+        node* peek(void)
+        {
+            return m_head.load(boost::memory_order_acquire);
+        }
+
     private:
         boost::atomic<node*> m_head;
 